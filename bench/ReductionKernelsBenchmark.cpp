@@ -0,0 +1,77 @@
+#include "ReductionKernels.h"
+
+#include <omp.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace picmdk;
+
+
+// Throughput of the reduction kernels of each supported instruction set compared to
+// the generic scalar versions, for sizes fitting in L1, in L2 and in none of the caches.
+// Usage: ReductionKernelsBenchmark [minimal time per measurement in seconds]
+namespace {
+
+double minTime = 0.2;
+
+// Run the kernel until minTime passes, return the processed data in GB/s:
+// each element is read from src and dst and written to dst
+template<typename T>
+double measure(void (*kernel)(T*, const T*, int), std::vector<T>& dst, const std::vector<T>& src)
+{
+    int n = (int)dst.size();
+    long long numRuns = 0;
+    double startTime = omp_get_wtime(), time = 0;
+    for (int runs = 1; time < minTime; runs *= 2) {
+        for (int i = 0; i < runs; i++)
+            kernel(&dst[0], &src[0], n);
+        numRuns += runs;
+        time = omp_get_wtime() - startTime;
+    }
+    return 3.0 * sizeof(T) * n * numRuns / time * 1e-9;
+}
+
+template<typename T>
+void benchmark(const char* kernelName, const char* typeName,
+    void (*kernel)(T*, const T*, int), void (*scalarKernel)(T*, const T*, int))
+{
+    const int sizesBytes[] = { 16 << 10, 512 << 10, 64 << 20 };
+    const kernels::InstructionSet supportedInstructionSet = kernels::getInstructionSet();
+    for (int s = 0; s < 3; s++) {
+        int n = sizesBytes[s] / (int)sizeof(T);
+        // Values equal to 1 keep products finite
+        std::vector<T> dst(n, (T)1), src(n, (T)1);
+        double scalarThroughput = measure(scalarKernel, dst, src);
+        std::printf("%-8s %-7s %10d %-8s %8.2f GB/s\n", kernelName, typeName, n, "generic", scalarThroughput);
+        for (int isa = kernels::Scalar; isa <= supportedInstructionSet; isa++) {
+            kernels::setInstructionSet((kernels::InstructionSet)isa);
+            double throughput = measure(kernel, dst, src);
+            std::printf("%-8s %-7s %10d %-8s %8.2f GB/s  x%.2f\n", kernelName, typeName, n,
+                kernels::getInstructionSetName((kernels::InstructionSet)isa), throughput, throughput / scalarThroughput);
+        }
+        kernels::setInstructionSet(supportedInstructionSet);
+    }
+}
+
+} // anonymous namespace
+
+
+int main(int argc, char** argv)
+{
+    if (argc > 1)
+        minTime = std::atof(argv[1]);
+    std::printf("Best supported instruction set: %s\n", kernels::getInstructionSetName(kernels::getInstructionSet()));
+    std::printf("%-8s %-7s %10s %-8s %13s\n", "kernel", "type", "elements", "version", "throughput");
+    benchmark<float>("sum", "float", kernels::sum, kernels::sum<float>);
+    benchmark<double>("sum", "double", kernels::sum, kernels::sum<double>);
+    benchmark<int>("sum", "int", kernels::sum, kernels::sum<int>);
+    benchmark<double>("product", "double", kernels::product, kernels::product<double>);
+    benchmark<int>("product", "int", kernels::product, kernels::product<int>);
+    benchmark<float>("max", "float", kernels::max, kernels::max<float>);
+    benchmark<double>("max", "double", kernels::max, kernels::max<double>);
+    benchmark<int>("max", "int", kernels::max, kernels::max<int>);
+    benchmark<double>("min", "double", kernels::min, kernels::min<double>);
+    return 0;
+}
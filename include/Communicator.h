@@ -26,6 +26,15 @@ public:
 
     virtual ~Communicator();
 
+    // Create a commutative or non-commutative MPI operation from the user function
+    // and a contiguous datatype of the given size in bytes. They are not bound
+    // to a communicator and are freed by freeOp() and freeDatatype(),
+    // which ignore errors so that they can be used in destructors.
+    static MPI_Op createOp(MPI_User_function* function, bool isCommutative);
+    static MPI_Datatype createContiguousDatatype(int sizeBytes);
+    static void freeOp(MPI_Op* op);
+    static void freeDatatype(MPI_Datatype* datatype);
+
     // Getters
     virtual int getRank() const = 0;
     virtual int getNumProcesses() const = 0;
@@ -45,10 +54,48 @@ public:
     virtual void bcast(void *buffer, int count, MPI_Datatype datatype, int root) = 0;
     virtual void gather(void *sendbuf, int sendcount, MPI_Datatype sendtype,
         void *recvbuf, int recvcount, MPI_Datatype recvtype, int root) = 0;
+    virtual void gatherv(void *sendbuf, int sendcount, MPI_Datatype sendtype,
+        void *recvbuf, int *recvcounts, int *displs, MPI_Datatype recvtype, int root) = 0;
+    virtual void allgather(void *sendbuf, int sendcount, MPI_Datatype sendtype,
+        void *recvbuf, int recvcount, MPI_Datatype recvtype) = 0;
+    virtual void allgatherv(void *sendbuf, int sendcount, MPI_Datatype sendtype,
+        void *recvbuf, int *recvcounts, int *displs, MPI_Datatype recvtype) = 0;
     virtual void reduce(void *sendbuf, void *recvbuf, int count,
         MPI_Datatype datatype, MPI_Op op, int root) = 0;
     virtual void allreduce(void *sendbuf, void *recvbuf, int count,
         MPI_Datatype datatype, MPI_Op op) = 0;
+    virtual void reduceScatter(void *sendbuf, void *recvbuf, int *recvcounts,
+        MPI_Datatype datatype, MPI_Op op) = 0;
+
+    // Non-blocking communication operations, completed by wait() or test()
+    virtual void iallreduce(void *sendbuf, void *recvbuf, int count,
+        MPI_Datatype datatype, MPI_Op op, MPI_Request *request) = 0;
+    virtual void ireduce(void *sendbuf, void *recvbuf, int count,
+        MPI_Datatype datatype, MPI_Op op, int root, MPI_Request *request) = 0;
+    virtual void ireduceScatter(void *sendbuf, void *recvbuf, int *recvcounts,
+        MPI_Datatype datatype, MPI_Op op, MPI_Request *request) = 0;
+    virtual void igatherv(void *sendbuf, int sendcount, MPI_Datatype sendtype,
+        void *recvbuf, int *recvcounts, int *displs, MPI_Datatype recvtype, int root,
+        MPI_Request *request) = 0;
+    virtual void iallgatherv(void *sendbuf, int sendcount, MPI_Datatype sendtype,
+        void *recvbuf, int *recvcounts, int *displs, MPI_Datatype recvtype,
+        MPI_Request *request) = 0;
+    virtual void wait(MPI_Request *request, MPI_Status *status) = 0;
+    virtual bool test(MPI_Request *request, MPI_Status *status) = 0;
+
+    // Create a communicator of processes sharing memory with this one (MPI_Comm_split_type)
+    // or of processes with the same color (MPI_Comm_split), the latter is empty for MPI_UNDEFINED color
+    virtual ::std::auto_ptr<Communicator> splitShared() = 0;
+    virtual ::std::auto_ptr<Communicator> split(int color, int key) = 0;
+
+    // Shared memory windows for communicators of processes sharing memory.
+    // Each process allocates a segment of the given size, segments of all processes are accessed directly.
+    // synchronizeSharedWindow() makes writes of all processes visible to all processes.
+    // These operations except getSharedWindowSegment() are collective.
+    virtual void* allocateSharedWindow(long long sizeBytes, MPI_Win* window) = 0;
+    virtual void* getSharedWindowSegment(MPI_Win window, int rank) = 0;
+    virtual void synchronizeSharedWindow(MPI_Win window) = 0;
+    virtual void freeSharedWindow(MPI_Win* window) = 0;
 
 };
 
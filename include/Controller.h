@@ -5,10 +5,16 @@
 #include "Communicator.h"
 #include "ComputationLog.h"
 #include "Handler.h"
+#include "MemoryArena.h"
 #include "Module.h"
 #include "OpenMPWrapper.h"
 #include "Vector.h"
 
+#include <cstring>
+#include <exception>
+#include <new>
+#include <set>
+#include <string>
 #include <vector>
 
 
@@ -21,11 +27,12 @@ public:
     HandlerInitializer(const std::string& _moduleName, const std::string& _moduleInstanceName) :
         moduleName(_moduleName), moduleInstanceName(_moduleInstanceName) {}
 
+    // The handler is constructed in the given memory if it is set
     template<class Handler, class Input>
     Handler* createHandler(Input* input, ComputationLog* computationLog,
-        InterData* interData, Communicator* communicator, typename Handler::Data* data)
+        InterData* interData, Communicator* communicator, typename Handler::Data* data, void* memory = 0)
     {
-        Handler* handler = new Handler;
+        Handler* handler = memory ? new (memory) Handler : new Handler;
         handler->input = input;
         handler->computationLog = computationLog;
         handler->interData = interData;
@@ -53,7 +60,7 @@ public:
     typedef typename Adapter::Grid Grid;
     typedef typename Adapter::Input Input;
     typedef Vector3<int> Int3;
-    typedef InterData InterData;
+    typedef ::picmdk::InterData InterData;
     typedef typename Adapter::Particle Particle;
     typedef typename Adapter::Ensemble::ParticleIterator ParticleIterator;
     typedef typename Adapter::Position Position;
@@ -68,7 +75,24 @@ public:
         communicator(_communicator),
         input(_input),
         computationLog(ComputationLog::getInstance())
-    {}
+    {
+        interData.setCommunicator(communicator);
+    }
+
+    // Handlers of threads are constructed in handlerArena, so they are destroyed explicitly.
+    // Asynchronous synchronizations still in flight write to the imports, so they are completed first
+    ~Controller()
+    {
+        interData.waitSynchronizationAll();
+        for (size_t i = 0; i < particleHandlers.size(); i++)
+            for (size_t t = 0; t < particleHandlers[i].size(); t++)
+                particleHandlers[i][t]->~Handler();
+        for (size_t i = 0; i < cellHandlers.size(); i++)
+            for (size_t t = 0; t < cellHandlers[i].size(); t++)
+                cellHandlers[i][t]->~Handler();
+        for (size_t i = 0; i < staticHandlers.size(); i++)
+            staticHandlers[i]->~Handler();
+    }
 
     void addModule(Module<Controller>& module)
     {
@@ -78,16 +102,33 @@ public:
         module.addHandlers(*this);
     }
 
-    // Adding handlers, these are called automatically for modules declared with PICMDK_MODULE
+    // Adding handlers, these are called automatically for modules declared with PICMDK_MODULE.
+    // Particle and cell handlers have a copy for each thread
     template<class ParticleHandler>
     void addParticleHandler()
     {
-       PICMDK_THROW(NotImplementedException, ("Particle handlers are not currently implemented"));
+        particleHandlers.push_back(createThreadHandlers<ParticleHandler, ParticleHandlerBase>());
     }
     template<class CellHandler>
     void addCellHandler()
     {
-        PICMDK_THROW(NotImplementedException, ("Cell handlers are not currently implemented"));
+        cellHandlers.push_back(createThreadHandlers<CellHandler, CellHandlerBase>());
+    }
+
+    // Create per-thread copies of a particle or cell handler of a static module, see StaticModuleImplementation.
+    // The copies are owned by the controller, but not run by runParticleHandlers() and runCellHandlers().
+    // Activity of the copies is written to isActive once per iteration, as for other handlers
+    template<class ThreadHandler>
+    std::vector<ThreadHandler*> createStaticHandlers(bool* isActive)
+    {
+        std::vector<ThreadHandler*> threadHandlers = createThreadHandlers<ThreadHandler, ThreadHandler>();
+        staticHandlers.insert(staticHandlers.end(), threadHandlers.begin(), threadHandlers.end());
+        StaticHandlerActivity activity;
+        activity.handler = threadHandlers[0];
+        activity.isActive = isActive;
+        staticHandlerActivity.push_back(activity);
+        *isActive = activity.handler->isActiveIteration();
+        return threadHandlers;
     }
 
     template<class DomainHandler>
@@ -97,6 +138,7 @@ public:
             &input, &computationLog, &interData, communicator, &data);
         computationLog.write("   Initializing handler '" + handler->getHandlerName() +
             "', instance name '" + handler->getHandlerInstanceName() + "'");
+        interData.setCurrentHandler(handler);
         handler->init();
         handler->registerFunctions(*this);
         domainHandlers.push_back(handler);
@@ -105,11 +147,72 @@ public:
     template<class OutputHandler>
     void addOutputHandler()
     {
-        OutputHandler* handler = new OutputHandler;
+        OutputHandler* handler = handlerInitializer->createHandler<OutputHandler, Input>(
+            &input, &computationLog, &interData, communicator, &data);
+        computationLog.write("   Initializing handler '" + handler->getHandlerName() +
+            "', instance name '" + handler->getHandlerInstanceName() + "'");
+        interData.setCurrentHandler(handler);
         handler->init();
         outputHandlers.push_back(handler);
     }
 
+    // Finish initialization, must be called after all modules are added
+    void finalizeInit()
+    {
+        interData.finalizeInit();
+        interData.writeMemoryUsage(computationLog.getLocalStream());
+        updateActiveHandlers();
+    }
+
+    // Set the grid of domains for halo exchange of InterData datasets, must be called before finalizeInit().
+    // Processes are numbered in row-major order of domain indexes, isPeriodic is set for each dimension
+    void setDomainDecomposition(const Int3& numDomains, const Int3& isPeriodic)
+    {
+        interData.setDomainDecomposition(numDomains, isPeriodic);
+    }
+
+    // Back storage of InterData datasets with huge pages, must be called before adding modules
+    void setInterDataHugePages(bool useHugePages)
+    {
+        interData.setUseHugePages(useHugePages);
+    }
+
+    // Reduce global InterData datasets between processes of each node through shared memory,
+    // so that only one process per node takes part in collectives, must be called before finalizeInit()
+    void setInterDataNodeReduction(bool nodeReduction)
+    {
+        interData.setNodeReduction(nodeReduction);
+    }
+
+    // Synchronize InterData datasets not bound to events, should be called after loops over particles and cells.
+    // Datasets bound to events are synchronized before running handlers of the events.
+    // In asynchronous mode global synchronization is only started here, handlers wait for the datasets
+    // they import before running: domain and output handlers and handler functions of events called
+    // outside of parallel regions right before they are run, particle and cell handlers and functions
+    // of per-particle and per-cell events in startIteration() and after the synchronization in runDomainHandlers().
+    void synchronizeInterData()
+    {
+        interData.synchronize(Event::numEvents, data.iteration);
+    }
+
+    void setAsynchronousSynchronization(bool asynchronous)
+    {
+        interData.setAsynchronous(asynchronous);
+    }
+
+    // Let asynchronous global synchronization of InterData datasets start while the previous one
+    // is still in flight, at the cost of second buffers, must be called before finalizeInit()
+    void setInterDataDoubleBuffering(bool doubleBuffering)
+    {
+        interData.setDoubleBuffering(doubleBuffering);
+    }
+
+    // Skip synchronization of InterData datasets which were not modified since the last one
+    void setInterDataDirtyTracking(bool dirtyTracking)
+    {
+        interData.setDirtyTracking(dirtyTracking);
+    }
+
 
     typedef void(*HandlerFunction)(Event&, Handler&);
     void registerHandlerFunction(HandlerFunction function, Event::Type type, Handler* handler)
@@ -117,14 +220,20 @@ public:
         handlerFunctions.push_back(function);
         types.push_back(type);
         handlers.push_back(handler);
+        isActiveHandler.push_back(true);
+        updateDispatchTables();
     }
 
+    // Call the handler functions subscribed to the event, see synchronizeInterData() for waiting for imports
     void handle(Event& event)
     {
-        Event::Type type = event.getType();
-        for (int i = 0; i < types.size(); i++)
-            if (types[i] == type)
-                handlerFunctions[i](event, *handlers[i]);
+        const std::vector<HandlerCall>& calls = dispatchTables[event.getType()];
+        bool isWaiting = !omp_in_parallel();
+        for (size_t i = 0; i < calls.size(); i++) {
+            if (isWaiting)
+                interData.waitSynchronization(calls[i].handler);
+            calls[i].function(event, *calls[i].handler);
+        }
     }
 
     void startIteration(Real timeStep)
@@ -133,40 +242,70 @@ public:
         data.timeStep = timeStep;
         data.iterationStartTime = data.iterationEndTime;
         data.iterationEndTime += data.timeStep;
+        updateActiveHandlers();
+        waitThreadHandlerImports();
     }
 
     void resetCurrentData(Data newData)
     {
         data = newData;
+        updateActiveHandlers();
     }
 
-    // Run handlers
+    // Whether runParticleHandlers() and runCellHandlers() have anything to run on the current iteration,
+    // the loops over particles and cells for handlers can be skipped otherwise
+    bool hasActiveParticleHandlers() const
+    {
+        return !activeParticleHandlers.empty() && !activeParticleHandlers[0].empty();
+    }
+    bool hasActiveCellHandlers() const
+    {
+        return !activeCellHandlers.empty() && !activeCellHandlers[0].empty();
+    }
+
+    // Run handlers, only handlers active on the current iteration are run
     
     void runParticleHandlers(Particle& particle, const Real3& E, const Real3& B)
     {
-        int threadIdx = omp_get_thread_num();
-        for (size_t i = 0; i < particleHandlers.size(); i++)
-            particleHandlers[i][threadIdx]->handle(particle, E, B);
+        const std::vector<ParticleHandlerBase*>& threadHandlers = activeParticleHandlers[omp_get_thread_num()];
+        for (size_t i = 0; i < threadHandlers.size(); i++)
+            threadHandlers[i]->handle(particle, E, B);
+    }
+
+    // Run particle handlers for a chunk of particles with fields given as arrays of the same size.
+    // Each handler processes the whole chunk before the next one
+    void runParticleHandlers(Particle* particles, const Real3* E, const Real3* B, int numParticles)
+    {
+        const std::vector<ParticleHandlerBase*>& threadHandlers = activeParticleHandlers[omp_get_thread_num()];
+        for (size_t i = 0; i < threadHandlers.size(); i++)
+            threadHandlers[i]->handleBatch(particles, E, B, numParticles);
     }
     
     
     void runCellHandlers(Cell& cell)
     {
-        int threadIdx = omp_get_thread_num();
-        for (size_t i = 0; i < cellHandlers.size(); i++)
-            cellHandlers[i][threadIdx]->handle(cell);
+        const std::vector<CellHandlerBase*>& threadHandlers = activeCellHandlers[omp_get_thread_num()];
+        for (size_t i = 0; i < threadHandlers.size(); i++)
+            threadHandlers[i]->handle(cell);
     }
 
     void runDomainHandlers(Ensemble& ensemble, Grid& grid)
     {
-        for (size_t i = 0; i < domainHandlers.size(); i++)
-            domainHandlers[i]->handle(ensemble, grid);
+        interData.synchronize(Event::IterationStart, data.iteration);
+        for (size_t i = 0; i < activeDomainHandlers.size(); i++) {
+            interData.waitSynchronization(activeDomainHandlers[i]);
+            activeDomainHandlers[i]->handle(ensemble, grid);
+        }
+        waitThreadHandlerImports();
     }
 
     void runOutputHandlers()
     {
-        for (size_t i = 0; i < outputHandlers.size(); i++)
-            outputHandlers[i]->handle();
+        interData.synchronize(Event::Output, data.iteration);
+        for (size_t i = 0; i < activeOutputHandlers.size(); i++) {
+            interData.waitSynchronization(activeOutputHandlers[i]);
+            activeOutputHandlers[i]->handle();
+        }
     }
 
     ComputationLog& getComputationLog()
@@ -176,6 +315,163 @@ public:
 
 private:
 
+    // Create a copy of the handler for each thread. Memory of each copy is allocated from handlerArena
+    // and touched by its thread in parallel. The arena gives each thread its own blocks, which are mapped
+    // fresh on Linux, so the copy is placed on the NUMA node of its thread and copies of neighbouring
+    // threads never share cache lines. Each copy is then constructed and initialized by its thread,
+    // so its InterData datasets are first touched by this thread as well. Only allocation runs in parallel:
+    // initialization is ordered by threads, as InterData expects the copies to be registered
+    // in order of threads and init() of handlers is not required to be thread-safe.
+    // Exceptions can not leave the parallel region, so the first one is rethrown as is after it,
+    // when the created copies are destroyed, their memory is given back to the arena
+    // and their InterData datasets are unregistered.
+    template<class ThreadHandler, class Base>
+    std::vector<Base*> createThreadHandlers()
+    {
+        int numThreads = omp_get_max_threads();
+        std::vector<Base*> threadHandlers(numThreads, (Base*)0);
+        std::vector<void*> memory(numThreads, (void*)0);
+        std::vector<std::exception_ptr> allocationErrors(numThreads);
+        std::exception_ptr error;
+        #pragma omp parallel for ordered schedule(static, 1) num_threads(numThreads)
+        for (int threadIdx = 0; threadIdx < numThreads; threadIdx++) {
+            try {
+                memory[threadIdx] = handlerArena.allocate(sizeof(ThreadHandler));
+                std::memset(memory[threadIdx], 0, sizeof(ThreadHandler));
+            }
+            catch (...) {
+                allocationErrors[threadIdx] = std::current_exception();
+            }
+            #pragma omp ordered
+            {
+                ThreadHandler* handler = 0;
+                try {
+                    if (!error && allocationErrors[threadIdx])
+                        std::rethrow_exception(allocationErrors[threadIdx]);
+                    if (!error)
+                        createThreadHandler<ThreadHandler>(threadIdx, memory[threadIdx], handler);
+                }
+                catch (...) {
+                    error = std::current_exception();
+                }
+                threadHandlers[threadIdx] = handler;
+            }
+        }
+        if (error) {
+            interData.unregisterHandlers(std::set<const Handler*>(threadHandlers.begin(), threadHandlers.end()));
+            for (int threadIdx = numThreads - 1; threadIdx >= 0; threadIdx--) {
+                if (threadHandlers[threadIdx])
+                    threadHandlers[threadIdx]->~Handler();
+                if (memory[threadIdx])
+                    handlerArena.release(memory[threadIdx], sizeof(ThreadHandler));
+            }
+            std::rethrow_exception(error);
+        }
+        return threadHandlers;
+    }
+
+    // The handler is set right after construction, so that it is known in case init() throws
+    template<class ThreadHandler>
+    void createThreadHandler(int threadIdx, void* memory, ThreadHandler*& handler)
+    {
+        handler = handlerInitializer->createHandler<ThreadHandler, Input>(
+            &input, &computationLog, &interData, communicator, &data, memory);
+        if (threadIdx == 0)
+            computationLog.write("   Initializing handler '" + handler->getHandlerName() +
+                "', instance name '" + handler->getHandlerInstanceName() + "' for each thread");
+        interData.setCurrentHandler(handler);
+        handler->init();
+    }
+
+    // Rebuild the handler calls of each event from the registered handler functions of active handlers,
+    // keeping the order of registration
+    void updateDispatchTables()
+    {
+        for (int event = 0; event < Event::numEvents; event++)
+            dispatchTables[event].clear();
+        for (size_t i = 0; i < types.size(); i++) {
+            if (!isActiveHandler[i])
+                continue;
+            HandlerCall call;
+            call.function = handlerFunctions[i];
+            call.handler = handlers[i];
+            dispatchTables[types[i]].push_back(call);
+        }
+    }
+
+    // Evaluate activity of handlers once per iteration, so that the loops running handlers
+    // only walk the active ones. Copies of a handler for threads are active together,
+    // so activity is taken from the copy of the first thread.
+    // Dispatch tables are only rebuilt when activity of their handlers changes
+    void updateActiveHandlers()
+    {
+        updateActiveThreadHandlers(particleHandlers, activeParticleHandlers);
+        updateActiveThreadHandlers(cellHandlers, activeCellHandlers);
+        updateActiveHandlers(domainHandlers, activeDomainHandlers);
+        updateActiveHandlers(outputHandlers, activeOutputHandlers);
+        for (size_t i = 0; i < staticHandlerActivity.size(); i++)
+            *staticHandlerActivity[i].isActive = staticHandlerActivity[i].handler->isActiveIteration();
+        bool isChanged = false;
+        for (size_t i = 0; i < handlers.size(); i++) {
+            bool isActive = handlers[i]->isActiveIteration();
+            if (isActive != isActiveHandler[i]) {
+                isActiveHandler[i] = isActive;
+                isChanged = true;
+            }
+        }
+        if (isChanged)
+            updateDispatchTables();
+    }
+
+    // Complete asynchronous synchronization of the datasets imported by handlers run in the loops
+    // over particles and cells on the current iteration, so that they never see the buffers in flight.
+    // The loops are parallel, so it can not be done there. Copies of a handler import the same datasets,
+    // so waiting for the copy of the first thread is enough
+    void waitThreadHandlerImports()
+    {
+        if (hasActiveParticleHandlers())
+            for (size_t i = 0; i < activeParticleHandlers[0].size(); i++)
+                interData.waitSynchronization(activeParticleHandlers[0][i]);
+        if (hasActiveCellHandlers())
+            for (size_t i = 0; i < activeCellHandlers[0].size(); i++)
+                interData.waitSynchronization(activeCellHandlers[0][i]);
+        for (size_t i = 0; i < staticHandlerActivity.size(); i++)
+            if (*staticHandlerActivity[i].isActive)
+                interData.waitSynchronization(staticHandlerActivity[i].handler);
+        const Event::Type threadEvents[] = { Event::ParticlePostPush, Event::Cell };
+        for (int e = 0; e < 2; e++)
+            for (size_t i = 0; i < dispatchTables[threadEvents[e]].size(); i++)
+                interData.waitSynchronization(dispatchTables[threadEvents[e]][i].handler);
+    }
+
+    template<class Base>
+    void updateActiveHandlers(const std::vector<Base*>& allHandlers, std::vector<Base*>& activeHandlers)
+    {
+        activeHandlers.clear();
+        for (size_t i = 0; i < allHandlers.size(); i++)
+            if (allHandlers[i]->isActiveIteration())
+                activeHandlers.push_back(allHandlers[i]);
+    }
+
+    template<class Base>
+    void updateActiveThreadHandlers(const std::vector<std::vector<Base*> >& threadHandlers,
+        std::vector<std::vector<Base*> >& activeThreadHandlers)
+    {
+        int numThreads = omp_get_max_threads();
+        activeThreadHandlers.resize(numThreads);
+        for (int threadIdx = 0; threadIdx < numThreads; threadIdx++)
+            activeThreadHandlers[threadIdx].clear();
+        for (size_t i = 0; i < threadHandlers.size(); i++)
+            if (threadHandlers[i][0]->isActiveIteration())
+                for (int threadIdx = 0; threadIdx < numThreads; threadIdx++)
+                    activeThreadHandlers[threadIdx].push_back(threadHandlers[i][threadIdx]);
+    }
+
+private:
+
+    typedef ParticleHandler<Controller> ParticleHandlerBase;
+    typedef CellHandler<Controller> CellHandlerBase;
+
     Communicator* communicator;
     Input input;
     InterData interData;
@@ -183,16 +479,40 @@ private:
     Data data;
 
     std::auto_ptr<HandlerInitializer> handlerInitializer;
+    MemoryArena handlerArena; // storage of handlers of threads
 
     std::vector<Handler*> handlers;
     std::vector<Event::Type> types;
     std::vector<HandlerFunction> handlerFunctions;
 
+    // Handler function subscribed to an event
+    struct HandlerCall {
+        HandlerFunction function;
+        Handler* handler;
+    };
+    std::vector<HandlerCall> dispatchTables[Event::numEvents]; // handler calls of each event, see updateDispatchTables()
+    std::vector<bool> isActiveHandler; // activity of handlers of the registered functions on the current iteration
+
     std::vector<std::vector<ParticleHandler<Controller>*> > particleHandlers;
     std::vector<std::vector<CellHandler<Controller>*> > cellHandlers;
     std::vector<DomainHandler<Controller>*> domainHandlers;
     std::vector<OutputHandler<Controller>*> outputHandlers;
 
+    // Copies of particle and cell handlers active on the current iteration, for each thread
+    std::vector<std::vector<ParticleHandlerBase*> > activeParticleHandlers;
+    std::vector<std::vector<CellHandlerBase*> > activeCellHandlers;
+    // Domain and output handlers active on the current iteration
+    std::vector<DomainHandler<Controller>*> activeDomainHandlers;
+    std::vector<OutputHandler<Controller>*> activeOutputHandlers;
+    std::vector<Handler*> staticHandlers; // handlers of static modules, see createStaticHandlers()
+
+    // Activity flag of a static handler, set from its copy of the first thread
+    struct StaticHandlerActivity {
+        Handler* handler;
+        bool* isActive;
+    };
+    std::vector<StaticHandlerActivity> staticHandlerActivity;
+
 };
 
 
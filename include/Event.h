@@ -52,7 +52,7 @@ public:
     {
     }
 
-    virtual Event::Type getType() const { return Event::PostParticlePush; }
+    virtual Event::Type getType() const { return Event::ParticlePostPush; }
 
     Particle& getParticle() { return particle; }
     Ensemble& getEnsemble() { return ensemble; }
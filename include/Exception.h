@@ -69,6 +69,14 @@ public:
 };
 
 
+// Thrown in case a file can not be opened or written
+class FileException : public NamedException {
+public:
+    FileException(const std::string& message);
+    virtual ~FileException() throw();
+};
+
+
 
 } // namespace picmdk
 
@@ -5,6 +5,7 @@
 #include "Communicator.h"
 #include "ComputationLog.h"
 #include "Event.h"
+#include "Exception.h"
 #include "InterData.h"
 #include "Utility.h"
 
@@ -32,6 +33,10 @@ public:
     // Return type of the handler
     virtual Type getType() const = 0;
 
+    // Whether the handler is active on the current iteration.
+    // The controller evaluates it once per iteration, inactive handlers are not run
+    virtual bool isActiveIteration() { return true; }
+
     // Serialization of the internal state of the handler.
     virtual void save(std::ostream& f) {}
     virtual void load(std::istream& f) {}
@@ -97,8 +102,21 @@ public:
         }
     };
 
+    HandlerImplementation():
+        schedulePeriod(1),
+        scheduleOffset(0)
+    {
+    }
+
     virtual void registerFunctions(Controller& controller) = 0;
 
+    // Active on the iterations of the schedule, by default on each iteration
+    virtual bool isActiveIteration()
+    {
+        return (data->iteration >= scheduleOffset) &&
+            ((data->iteration - scheduleOffset) % schedulePeriod == 0);
+    }
+
     virtual std::string getHandlerName() const { return handlerName; }
     virtual std::string getHandlerInstanceName() const {
         if (handlerInstanceName != "")
@@ -121,14 +139,43 @@ protected:
     std::string handlerName, handlerInstanceName;
     std::string moduleName, moduleInstanceName;
 
+    // Make the handler active only on iterations offset, offset + period, offset + 2 * period, ...
+    // e.g. setSchedule(50) for each 50th iteration; should be called in the constructor or init()
+    void setSchedule(int period, int offset = 0)
+    {
+        if ((period < 1) || (offset < 0))
+            PICMDK_THROW(NamedException, ("handler '" + getHandlerInstanceName() +
+                "' has a schedule with non-positive period or negative offset", "schedule exception"));
+        schedulePeriod = period;
+        scheduleOffset = offset;
+    }
+
+private:
+
+    int schedulePeriod, scheduleOffset;
+
     friend class HandlerInitializer;
 
 };
 
 
+namespace internal {
+
+template<class Controller>
+void domainHandlerFunction(Event& event, Handler& handler);
+
+template<class Controller>
+void outputHandlerFunction(Event& event, Handler& handler);
+
+} // namespace picmdk::internal
+
+
 template<class Controller>
 class DomainHandler : public HandlerImplementation<Controller> {
 public:
+    typedef typename HandlerImplementation<Controller>::Ensemble Ensemble;
+    typedef typename HandlerImplementation<Controller>::Grid Grid;
+
     virtual Handler::Type getType() const { return Handler::Domain; }
     virtual void registerFunctions(Controller& controller)
     {
@@ -143,26 +190,42 @@ public:
 template<class Controller>
 class CellHandler : public HandlerImplementation<Controller> {
 public:
-    CellHandler(): HandlerImplementation<Controller>(HandlerType_Cell) {}
+    typedef typename HandlerImplementation<Controller>::Cell Cell;
+
+    virtual Handler::Type getType() const { return Handler::Cell; }
+    // Cell handlers are run by the controller in loops over cells, so no functions are registered
+    virtual void registerFunctions(Controller& /*controller*/) {}
     virtual void handle(Cell& cell) = 0;
-    virtual bool isActiveIteration() {return true; }
 };
 
 template<class Controller>
 class ParticleHandler : public HandlerImplementation<Controller> {
 public:
-    ParticleHandler(): HandlerImplementation<Controller>(HandlerType_Particle) {}
+    typedef typename HandlerImplementation<Controller>::Particle Particle;
+    typedef typename HandlerImplementation<Controller>::Real3 Real3;
+
+    virtual Handler::Type getType() const { return Handler::Particle; }
+    // Particle handlers are run by the controller in loops over particles, so no functions are registered
+    virtual void registerFunctions(Controller& /*controller*/) {}
 
     // Process particle data, change status if necessary
     virtual void handle(Particle& particle, const Real3& E, const Real3& B) = 0;
-    virtual bool isActiveIteration() { return true; }
+
+    // Process a chunk of particles, E[i] and B[i] are fields for particles[i].
+    // Handlers can override it to process the chunk without a virtual call per particle,
+    // by default handle() is called for each particle
+    virtual void handleBatch(Particle* particles, const Real3* E, const Real3* B, int numParticles)
+    {
+        for (int i = 0; i < numParticles; i++)
+            handle(particles[i], E[i], B[i]);
+    }
 };
 
 
 template<class Controller>
 class OutputHandler : public HandlerImplementation<Controller> {
 public:
-    OutputHandler(): HandlerImplementation<Controller>(HandlerType_Output) {}
+    virtual Handler::Type getType() const { return Handler::Output; }
     virtual void registerFunctions(Controller& controller)
     {
         controller.registerHandlerFunction(
@@ -208,7 +271,11 @@ void outputHandlerFunction(Event& event, Handler& handler)
 // It should not be used directly.
 template<class Controller>
 class DummyHandler : public HandlerImplementation<Controller> {
-    DummyHandler(): HandlerImplementation<Controller>(HandlerType_Dummy) {}
+public:
+    virtual Handler::Type getType() const { return Handler::Dummy; }
+    virtual void registerFunctions(Controller& /*controller*/) {}
+private:
+    DummyHandler() {}
 };
 
 } // namespace picmdk
@@ -2,43 +2,211 @@
 #define MDK_INTERDATA_H
 
 
+#include "Communicator.h"
+#include "Event.h"
 #include "Exception.h"
+#include "MemoryArena.h"
+#include "MPIWrapper.h"
+#include "ReductionKernels.h"
 #include "Utility.h"
 #include "Vector.h"
 
+#include <algorithm>
 #include <cstring>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <ostream>
+#include <set>
 #include <string>
+#include <vector>
 
 
 namespace picmdk {
 
 class Handler;
 
+
+namespace internal {
+
+// Description of an element type of InterData datasets in terms of its scalar components,
+// used by synchronizers to run reductions component-wise and to pass data to MPI.
+// Arithmetic types are single-component, Vector2 and Vector3 are 2- and 3-component.
+template<typename T>
+struct ElementTraits {
+    typedef T Scalar;
+    static const int numComponents = 1;
+};
+
+template<typename T>
+struct ElementTraits<Vector2<T> > {
+    typedef T Scalar;
+    static const int numComponents = 2;
+};
+
+template<typename T>
+struct ElementTraits<Vector3<T> > {
+    typedef T Scalar;
+    static const int numComponents = 3;
+};
+
+// MPI datatype for a scalar type, MPI_DATATYPE_NULL for types without one
+template<typename T>
+inline MPI_Datatype getMPIDatatype() { return MPI_DATATYPE_NULL; }
+template<> inline MPI_Datatype getMPIDatatype<char>() { return MPI_CHAR; }
+template<> inline MPI_Datatype getMPIDatatype<int>() { return MPI_INT; }
+template<> inline MPI_Datatype getMPIDatatype<unsigned int>() { return MPI_UNSIGNED; }
+template<> inline MPI_Datatype getMPIDatatype<long>() { return MPI_LONG; }
+template<> inline MPI_Datatype getMPIDatatype<long long>() { return MPI_LONG_LONG; }
+template<> inline MPI_Datatype getMPIDatatype<float>() { return MPI_FLOAT; }
+template<> inline MPI_Datatype getMPIDatatype<double>() { return MPI_DOUBLE; }
+
+// Number of elements of an array of the given size, in 64 bits so that large datasets do not overflow
+inline long long volume(const Vector2<int>& size)
+{
+    return (long long)size.x * size.y;
+}
+
+inline long long volume(const Vector3<int>& size)
+{
+    return (long long)size.x * size.y * size.z;
+}
+
+} // namespace picmdk::internal
+
+
 class InterData {
 public:
 
     struct SynchronizationMode {
         // Operation to perform during synchonization:
-        // all except Gather are reduction-type operations,
-        // Gather is analogue of MPI_Gather
-        enum Operation {None, Sum, Product, Max, Min, Average, Gather};
+        // all except Gather and AllGather are reduction-type operations,
+        // Gather is analogue of MPI_Gatherv with the root set by setRoot(), AllGather of MPI_Allgatherv.
+        // For gathers contributions of threads and processes can have different sizes
+        // and are concatenated in order of threads and ranks, the imports must be Array<T>.
+        // Copy is supported only for Halo locality, the copy of the first thread is taken.
+        // Custom is set by registerCustomExport() for user-defined reductions.
+        // MaxLoc and MinLoc are for elements of type KeyPayload, the element with the maximal
+        // or minimal key is taken together with its payload.
+        enum Operation {None, Sum, Product, Max, Min, Average, Gather, AllGather, Copy, Custom, MaxLoc, MinLoc};
 
         // Perform synchronization globally - for all domains and threads
-        // or locally - for each domain synchronize between its threads
-        enum Locality {Global, Local};
+        // or locally - for each domain synchronize between its threads.
+        // Root and ReduceScatter are global reductions with the result received by a part of processes,
+        // the imports of other processes are not updated. For Root only the process set by setRoot()
+        // receives the result. For ReduceScatter the result is split into slabs of contiguous slices
+        // of the first index, each process receives its slab given by getReduceScatterSlab().
+        // Halo is for DomainArray3d datasets: after the thread-level stage the ghost layers
+        // are exchanged with the neighbouring domains set by Controller::setDomainDecomposition().
+        // With Sum ghost values are added to the neighbours' cells and then the ghost layers are
+        // refreshed, with Copy the ghost layers are only refreshed. Ghost layers at non-periodic
+        // boundaries keep the values of this domain.
+        enum Locality {Global, Local, Root, ReduceScatter, Halo};
 
         // Finalization of the original data after synchronization is done
-        // None - do nothing, Clear - set to 0
+        // None - do nothing, Clear - set to 0, for MaxLoc and MinLoc to the identity, see KeyPayload
         enum Finalization { Keep, Clear };
 
+        // Storage of the dataset for threads of a process:
+        // Private - each thread has its own copy, copies are reduced during synchronization,
+        // Shared - all threads use the copy registered first, so there is no thread-level reduction.
+        // Shared datasets must be updated with atomicAdd() and only Sum operation is supported.
+        // LazyPrivate - each thread has its own copy with memory pages allocated on first touch,
+        // only touched pages are reduced. It suits sparsely updated datasets, the copies are
+        // zero-initialized (the data at registration is discarded), Sum and Average are supported
+        enum Sharing { Private, Shared, LazyPrivate };
+
+        // When the dataset is synchronized. By default it is done at each Controller::synchronizeInterData().
+        // A dataset bound to an event is instead synchronized right before handlers of this event are run,
+        // only Event::IterationStart and Event::Output are supported. Besides, synchronization can be
+        // done only every period-th iteration and only on iterations when isActiveIteration()
+        // of some of the importing handlers is true.
+        // For global synchronization the schedule must give the same decisions on all processes.
+        struct Schedule {
+            Event::Type event; // Event::numEvents if not bound to an event
+            int period;
+            bool onlyActiveImporters;
+
+            Schedule():
+                event(Event::numEvents),
+                period(1),
+                onlyActiveImporters(false)
+            {
+            }
+
+            bool operator==(const Schedule& other) const
+            {
+                return (event == other.event) && (period == other.period) &&
+                    (onlyActiveImporters == other.onlyActiveImporters);
+            }
+        };
+
         Operation operation;
         Locality locality;
         Finalization finalization;
+        Sharing sharing;
+        Schedule schedule;
+        int root; // receiving process for Root locality and Gather
 
-        SynchronizationMode(Operation _operation, Locality _locality, Finalization _finalization = Keep):
+        SynchronizationMode(Operation _operation, Locality _locality, Finalization _finalization = Keep,
+            Sharing _sharing = Private):
             operation(_operation),
             locality(_locality),
-            finalization(_finalization)
+            finalization(_finalization),
+            sharing(_sharing),
+            root(0)
+        {
+        }
+
+        SynchronizationMode& setRoot(int _root)
+        {
+            root = _root;
+            return *this;
+        }
+
+        // Schedule setters, can be chained as SynchronizationMode(Sum, Global).bindToEvent(Event::Output).setPeriod(10)
+        SynchronizationMode& bindToEvent(Event::Type event)
+        {
+            schedule.event = event;
+            return *this;
+        }
+
+        SynchronizationMode& setPeriod(int period)
+        {
+            schedule.period = period;
+            return *this;
+        }
+
+        SynchronizationMode& setOnlyActiveImporters()
+        {
+            schedule.onlyActiveImporters = true;
+            return *this;
+        }
+    };
+
+    template<typename Record>
+    class ParticleList;
+
+    // Element type for MaxLoc and MinLoc operations: the key to compare and the attached payload,
+    // e.g. particle energy and position, momentum and rank of the particle. Both must be POD types,
+    // Payload must have operator<. Of elements with equal keys the one with the smaller payload is taken,
+    // so that the result is the same for any order of reduction.
+    // Copies are set to the identity of the reduction at registration and by Clear finalization:
+    // the key is the lowest value of Key for MaxLoc and the highest for MinLoc, the payload is Payload().
+    template<typename Key, typename Payload>
+    struct KeyPayload {
+        Key key;
+        Payload payload;
+
+        KeyPayload():
+            key(),
+            payload()
+        {
+        }
+
+        KeyPayload(const Key& _key, const Payload& _payload):
+            key(_key),
+            payload(_payload)
         {
         }
     };
@@ -47,48 +215,174 @@ public:
     template<class DataSet>
     void registerExport(DataSet* dataSet, const std::string& name, SynchronizationMode mode)
     {
+        int ownerIdx = findSharedOwner(name, mode);
+        if (ownerIdx >= 0) {
+            shareRaw(dataSet, ownerIdx);
+            exportData[ownerIdx].sharedCopies.push_back(dataSet);
+            return;
+        }
+        if (mode.sharing == SynchronizationMode::LazyPrivate)
+            moveToPages(dataSet);
+        else
+            moveToArena(dataSet);
+        if ((mode.operation == SynchronizationMode::MaxLoc) || (mode.operation == SynchronizationMode::MinLoc)) {
+            ClearFinalizer<typename DataSet::ValueType> initializer(getIdentity((const typename DataSet::ValueType*)0, mode));
+            initializer.run(dataSet->getRaw(), dataSet->getNumElements());
+        }
         registerExport(dataSet, name, mode, createSynchronizer(dataSet, mode), createFinalizer(dataSet, mode));
     }
 
+    // Particle lists are concatenated, so only Gather and AllGather operations are supported
+    template<typename Record>
+    void registerExport(ParticleList<Record>* dataSet, const std::string& name, SynchronizationMode mode)
+    {
+        if ((mode.operation != SynchronizationMode::Gather) && (mode.operation != SynchronizationMode::AllGather))
+            PICMDK_THROW(SynchronizationException, ("particle list '" + name + "' supports only Gather and AllGather synchronization"));
+        registerExport(dataSet, name, mode, new NoneSynchronizer<Record>, createFinalizer(dataSet, mode));
+    }
+
+    // Register the given data set to be exported with a user-defined reduction instead of mode.operation.
+    // Reduction is a default-constructible functor with void operator()(ValueType& destination, const ValueType& source)
+    // combining source into destination, e.g. merging Welford mean and variance accumulators.
+    // It must be associative and commutative. The functor is used for the thread-level stage and
+    // wrapped into an MPI operation on a contiguous datatype, so global synchronization is a single collective.
+    // Only Private sharing is supported.
+    template<class Reduction, class DataSet>
+    void registerCustomExport(DataSet* dataSet, const std::string& name, SynchronizationMode mode)
+    {
+        typedef typename DataSet::ValueType ValueType;
+        if (mode.sharing != SynchronizationMode::Private)
+            PICMDK_THROW(SynchronizationException, ("dataset '" + name + "' with a custom reduction supports only Private sharing"));
+        mode.operation = SynchronizationMode::Custom;
+        moveToArena(dataSet);
+        registerExport(dataSet, name, mode, new CustomSynchronizer<ValueType, Reduction>(dataSet->getNumElements()),
+            createFinalizer(dataSet, mode));
+    }
+
     // Register the given data set to be imported from the existing dataset with the given name
     template<class DataSet>
     void registerImport(DataSet* dataSet, const std::string& name)
     {
-        registerImport(dataSet, name);
+        moveToArena(dataSet);
+        registerImport(static_cast<DataSetBase*>(dataSet), name);
+    }
+
+    // Get the range [begin, end) of the first index of the slab received by this process
+    // for a dataset with ReduceScatter locality, available after initialization
+    void getReduceScatterSlab(const std::string& name, int& begin, int& end) const;
+
+    // Add the value to the target atomically with respect to other threads, component-wise for vectors.
+    // To be used for updates of elements of datasets with Shared sharing
+    template<typename T>
+    static void atomicAdd(T& target, const T& value)
+    {
+        typedef typename internal::ElementTraits<T>::Scalar Scalar;
+        Scalar* t = (Scalar*)&target;
+        const Scalar* v = (const Scalar*)&value;
+        for (int c = 0; c < internal::ElementTraits<T>::numComponents; c++) {
+            #pragma omp atomic
+            t[c] += v[c];
+        }
     }
 
+    InterData();
+    ~InterData();
+
     //// TODO: change element(...) methods to at(...) STL-style ?
 
     // Abstract base class for all InterData data sets
     class DataSetBase {
     public:
+        DataSetBase():
+            isDirty(true)
+        {
+        }
+
         virtual ~DataSetBase()
         {
         }
 
-        // Access to raw data and size
+        // Access to raw data and size, sizes and element counts of datasets are 64-bit
         virtual void* getRaw() = 0;
-        virtual int getRawSizeBytes() const = 0;
+        virtual long long getRawSizeBytes() const = 0;
+
+        // Mark the data set as modified since the last synchronization.
+        // Non-const accessors do it automatically, it is needed only after writing through getRaw()
+        void markDirty()
+        {
+            isDirty = true;
+        }
+
+    protected:
+
+        bool isDirty;
+
+    private:
+
+        // Resize raw data to the given size in bytes, return whether the data set supports it.
+        // Used by InterData to place gathered data to imports.
+        virtual bool resizeRawBytes(long long /*sizeBytes*/)
+        {
+            return false;
+        }
+
+        // Number of elements in a slice of the first index, ReduceScatter splits data by slices
+        virtual long long getSliceNumElements() const
+        {
+            return 1;
+        }
+
+        // Get size including ghost layers and width of ghost layers, return whether the data set has them.
+        // Used by InterData for halo exchange.
+        virtual bool getGhostLayout(Vector3<int>& /*fullSize*/, int& /*ghostWidth*/) const
+        {
+            return false;
+        }
+
+        // Copy raw data to the given buffer of getRawSizeBytes() bytes.
+        // Used by InterData to concatenate gathered copies, overridden by data sets with non-contiguous storage.
+        virtual void packRaw(char* destination)
+        {
+            if (getRawSizeBytes())
+                std::memcpy(destination, getRaw(), getRawSizeBytes());
+        }
+
+        // Remove all data, return whether the data set supports it.
+        // Used by InterData for Clear finalization of gathered data sets instead of setting elements to 0.
+        virtual bool clearRaw()
+        {
+            return false;
+        }
+
+        // Whether raw data is placed in the given arena, unlike getRaw() it does not prepare the data.
+        // Used by InterData to report memory usage, data sets with non-contiguous storage are not in arena.
+        virtual bool isInArena(const MemoryArena& /*arena*/) const
+        {
+            return false;
+        }
+
+        friend class InterData;
     };
 
-    // Helper CRTP helper class for Value<T>, Array<T>, Array2d<T> and Array3d<T> to inherit.
-    // Template parameter is the dataset itself, not T.
-    template <class DataSet>
+    // Helper class for Value<T>, Array<T>, Array2d<T> and Array3d<T> to inherit.
+    // Template parameters are the element type and the index type of the dataset.
+    template <typename T, typename Index>
     class DataSetImplementation: public DataSetBase {
     public:
 
-        typedef typename DataSet::ValueType ValueType;
-        typedef typename DataSet::IndexType IndexType;
+        typedef T ValueType;
+        typedef Index IndexType;
 
         DataSetImplementation():
+            size(),
             raw(0),
             rawSize(0),
             ownsMemory(true)
         {
         }
 
-        DataSetImplementation(IndexType _size, int _rawSize, ValueType value = 0):
-            size(size),
+        DataSetImplementation(IndexType _size, long long _rawSize, ValueType value = ValueType()):
+            size(_size),
             rawSize(_rawSize),
             ownsMemory(true)
         {
@@ -102,7 +396,7 @@ public:
                 delete[] raw;
         }
 
-        int getNumElements() const
+        long long getNumElements() const
         {
             return rawSize;
         }
@@ -114,16 +408,16 @@ public:
         }
 
         // Implementation of DataSetBase interface
-        virtual int getRawSizeBytes() const
+        virtual long long getRawSizeBytes() const
         {
-            return rawSize * sizeof(ValueType);
+            return rawSize * (long long)sizeof(ValueType);
         }
 
     protected:
 
         IndexType size; // number of elements for each dimension (depends on DataSet)
         ValueType* raw; // pointer to raw data
-        int rawSize; // number of elements in raw data
+        long long rawSize; // number of elements in raw data
         bool ownsMemory; // whether the data set owns the raw pointer and has to free it
 
     private:
@@ -132,9 +426,23 @@ public:
         void changeRaw(ValueType* newRaw)
         {
             std::memcpy(newRaw, raw, rawSize * sizeof(ValueType));
+            setRaw(newRaw);
+        }
+
+        // Same without copying the current data
+        void setRaw(ValueType* newRaw)
+        {
+            if (ownsMemory)
+                delete[] raw;
             raw = newRaw;
             ownsMemory = false;
         }
+
+        // Implementation of DataSetBase interface
+        virtual bool isInArena(const MemoryArena& arena) const
+        {
+            return arena.contains(raw);
+        }
         
         // Copy and assignment are forbidden
         DataSetImplementation(const DataSetImplementation&);
@@ -156,6 +464,19 @@ public:
         }
     };
 
+    // Thrown in case exported and imported datasets can not be matched
+    class SynchronizationException : public NamedException {
+    public:
+        SynchronizationException(const std::string& message):
+            NamedException(message, "synchronization exception")
+        {
+        }
+
+        virtual ~SynchronizationException() throw()
+        {
+        }
+    };
+
     // All following classes are parametrized with type T,
     // which is supposed to be an arithmetic type (e.g. char, int, double, float)
     // or a POD structure (e.g. Vector3 of an arithmetic type)
@@ -164,19 +485,20 @@ public:
     // Interface of InterData::Value<T> class for module developers.
     // The class represents a single value of type T
     template<typename T>
-    class Value : public DataSetImplementation<Value<T> > {
+    class Value : public DataSetImplementation<T, int> {
     public:
         typedef T ValueType;
         typedef int IndexType; // for compatibility with DataSetImplementation
 
-        Value(ValueType value = 0):
-            DataSetImplementation<Value<T> >(1, 1, value)
+        Value(ValueType value = ValueType()):
+            DataSetImplementation<T, int>(1, 1, value)
         {
         }
 
         // Access the value
         ValueType& operator()()
         {
+            isDirty = true;
             return raw[0];
         }
 
@@ -188,6 +510,7 @@ public:
         // Access the value, these are for consistency with vector and matrix
         ValueType& element()
         {
+            isDirty = true;
             return raw[0];
         }
 
@@ -195,25 +518,32 @@ public:
         {
             return raw[0];
         }
+
+    protected:
+
+        // Members of the dependent base class
+        using DataSetImplementation<T, int>::isDirty;
+        using DataSetImplementation<T, int>::raw;
+
     };
 
     // Interface of InterData::Array<T> class for module developers.
     // The class represents a 1d array (vector) of type T
     template<typename T>
-    class Array : public DataSetImplementation<Array<T> > {
+    class Array : public DataSetImplementation<T, int> {
     public:
         typedef T ValueType;
         typedef int IndexType;
 
         // Create an empty vector
         Array():
-            DataSetImplementation<Array<T> >()
+            DataSetImplementation<T, int>()
         {
         }
 
         // Create an array of the given size with the given value of elements
-        Array(IndexType size, ValueType value = 0):
-            DataSetImplementation<Array<T> >(size, size, value)
+        Array(IndexType size, ValueType value = ValueType()):
+            DataSetImplementation<T, int>(size, size, value)
         {
         }
 
@@ -223,9 +553,26 @@ public:
             return size;
         }
 
+        // Change size of the vector, existing elements are kept and new ones are set to the given value
+        void resize(IndexType newSize, ValueType value = ValueType())
+        {
+            isDirty = true;
+            ValueType* newRaw = new ValueType[newSize];
+            IndexType numKept = std::min(newSize, size);
+            std::copy(raw, raw + numKept, newRaw);
+            std::fill(newRaw + numKept, newRaw + newSize, value);
+            if (ownsMemory)
+                delete[] raw;
+            raw = newRaw;
+            size = newSize;
+            rawSize = newSize;
+            ownsMemory = true;
+        }
+
         // Access the value by index without checking the index
         ValueType& operator()(IndexType index)
         {
+            isDirty = true;
             return raw[index];
         }
 
@@ -250,30 +597,48 @@ public:
             else
                 PICMDK_THROW(OutOfRangeException, ("index " + toString(index) + " is out of range for Array of size " + toString(size)));
         }
+
+    protected:
+
+        // Members of the dependent base class
+        using DataSetImplementation<T, int>::isDirty;
+        using DataSetImplementation<T, int>::size;
+        using DataSetImplementation<T, int>::raw;
+        using DataSetImplementation<T, int>::rawSize;
+        using DataSetImplementation<T, int>::ownsMemory;
+
+    private:
+
+        // Implementation of DataSetBase interface
+        virtual bool resizeRawBytes(long long sizeBytes)
+        {
+            resize((IndexType)(sizeBytes / (long long)sizeof(ValueType)));
+            return true;
+        }
     };
 
     // Interface of InterData::Array2d<T> class for module developers.
     // The class represents a 2d array (matrix) of type T
     template<typename T>
-    class Array2d : public DataSetImplementation<Array2d<T> > {
+    class Array2d : public DataSetImplementation<T, Vector2<int> > {
     public:
         typedef T ValueType;
         typedef Vector2<int> IndexType;
 
         // Create an empty matrix
         Array2d():
-            DataSetImplementation<Array2d<T> >()
+            DataSetImplementation<T, Vector2<int> >()
         {
         }
 
         // Create a matrix of the given size with the given value of elements
-        Array2d(int nRows, int nCols, ValueType value = 0):
-            DataSetImplementation<Array2d<T> >(Vector2<int>(nRows, nCols), nRows * nCols, value)
+        Array2d(int nRows, int nCols, ValueType value = ValueType()):
+            DataSetImplementation<T, Vector2<int> >(Vector2<int>(nRows, nCols), (long long)nRows * nCols, value)
         {
         }
 
-        Array2d(IndexType size, ValueType value = 0):
-            DataSetImplementation<Array2d<T> >(size, size.volume(), value)
+        Array2d(IndexType size, ValueType value = ValueType()):
+            DataSetImplementation<T, Vector2<int> >(size, internal::volume(size), value)
         {
         }
 
@@ -290,10 +655,10 @@ public:
 
         int getNumCols() const
         {
-            return size.z;
+            return size.y;
         }
 
-        int getNumElements() const
+        long long getNumElements() const
         {
             return rawSize;
         }
@@ -301,22 +666,24 @@ public:
         // Access the value by index without checking the index
         ValueType& operator()(int i, int j)
         {
-            return raw[i * size.y + j];
+            isDirty = true;
+            return raw[(long long)i * size.y + j];
         }
 
         const ValueType& operator()(int i, int j) const
         {
-            return raw[i * size.y + j];
+            return raw[(long long)i * size.y + j];
         }
 
         ValueType& operator()(IndexType index)
         {
-            return raw[index.x * size.y + index.y];
+            isDirty = true;
+            return raw[(long long)index.x * size.y + index.y];
         }
 
         const ValueType& operator()(IndexType index) const
         {
-            return raw[index.x * size.y + index.y];
+            return raw[(long long)index.x * size.y + index.y];
         }
 
         // Access the value by index with checking the index
@@ -351,30 +718,46 @@ public:
             else
                 PICMDK_THROW(OutOfRangeException, ("index " + toString(index) + " is out of range for Array2d of size " + toString(size)));
         }
+
+    protected:
+
+        // Members of the dependent base class
+        using DataSetImplementation<T, Vector2<int> >::isDirty;
+        using DataSetImplementation<T, Vector2<int> >::size;
+        using DataSetImplementation<T, Vector2<int> >::raw;
+        using DataSetImplementation<T, Vector2<int> >::rawSize;
+
+    private:
+
+        // Implementation of DataSetBase interface
+        virtual long long getSliceNumElements() const
+        {
+            return size.y;
+        }
     };
 
     // Interface of InterData::Array3d<T> class for module developers.
     // The class represents a 3d array of type T
     template<typename T>
-    class Array3d : public DataSetImplementation<Array3d<T> > {
+    class Array3d : public DataSetImplementation<T, Vector3<int> > {
     public:
         typedef T ValueType;
         typedef Vector3<int> IndexType;
 
         // Create an empty 3d array
         Array3d():
-            DataSetImplementation<Array3d<T> >()
+            DataSetImplementation<T, Vector3<int> >()
         {
         }
 
         // Create a matrix of the given size with the given value of elements
-        Array3d(int n1, int n2, int n3, T value = 0):
-            DataSetImplementation<Array3d<T> >(IndexType(n1, n2, n3), n1 * n2 * n3, value)
+        Array3d(int n1, int n2, int n3, T value = T()):
+            DataSetImplementation<T, Vector3<int> >(IndexType(n1, n2, n3), (long long)n1 * n2 * n3, value)
         {
         }
 
-        Array3d(IndexType size, T value = 0):
-            DataSetImplementation<Array3d<T> >(size, size.volume(), value)
+        Array3d(IndexType size, T value = T()):
+            DataSetImplementation<T, Vector3<int> >(size, internal::volume(size), value)
         {
         }
 
@@ -384,7 +767,7 @@ public:
             return size;
         }
 
-        int getNumElements() const
+        long long getNumElements() const
         {
             return rawSize;
         }
@@ -392,22 +775,24 @@ public:
         // Access the value by index without checking the index
         ValueType& operator()(int i, int j, int k)
         {
-            return raw[(i * size.y + j) * size.z + k];
+            isDirty = true;
+            return raw[((long long)i * size.y + j) * size.z + k];
         }
 
         const ValueType& operator()(int i, int j, int k) const
         {
-            return raw[(i * size.y + j) * size.z + k];
+            return raw[((long long)i * size.y + j) * size.z + k];
         }
 
         ValueType& operator()(IndexType index)
         {
-            return raw[(index.x * size.y + index.y) * size.z + index.z];
+            isDirty = true;
+            return raw[((long long)index.x * size.y + index.y) * size.z + index.z];
         }
 
         const ValueType& operator()(IndexType index) const
         {
-            return raw[(index.x * size.y + index.y) * size.z + index.z];
+            return raw[((long long)index.x * size.y + index.y) * size.z + index.z];
         }
 
         // Access the value by index with checking the index
@@ -443,90 +828,646 @@ public:
                 PICMDK_THROW(OutOfRangeException, ("index " + toString(index) + " is out of range for Array3d of size " + toString(size)));
         }
 
+    protected:
+
+        // Members of the dependent base class
+        using DataSetImplementation<T, Vector3<int> >::isDirty;
+        using DataSetImplementation<T, Vector3<int> >::size;
+        using DataSetImplementation<T, Vector3<int> >::raw;
+        using DataSetImplementation<T, Vector3<int> >::rawSize;
+
+    private:
+
+        // Implementation of DataSetBase interface
+        virtual long long getSliceNumElements() const
+        {
+            return (long long)size.y * size.z;
+        }
+    };
+
+    // Interface of InterData::DomainArray3d<T> class for module developers.
+    // The class represents a 3d array of type T over cells of the current domain surrounded
+    // by ghost layers of the given width. Cells of the domain have indexes from 0 to numCells - 1,
+    // ghost cells from -ghostWidth to -1 and from numCells to numCells + ghostWidth - 1.
+    template<typename T>
+    class DomainArray3d : public DataSetImplementation<T, Vector3<int> > {
+    public:
+        typedef T ValueType;
+        typedef Vector3<int> IndexType;
+
+        // Create an empty 3d array
+        DomainArray3d():
+            DataSetImplementation<T, Vector3<int> >(),
+            numCells(0, 0, 0),
+            ghostWidth(0)
+        {
+        }
+
+        // Create an array of the given number of cells with the given value of elements
+        DomainArray3d(IndexType _numCells, int _ghostWidth, T value = T()):
+            DataSetImplementation<T, Vector3<int> >(getFullSize(_numCells, _ghostWidth),
+                internal::volume(getFullSize(_numCells, _ghostWidth)), value),
+            numCells(_numCells),
+            ghostWidth(_ghostWidth)
+        {
+        }
+
+        // Create an array for the domain [localMin, localMax) with the given cell size,
+        // e.g. for Data::localMin and Data::localMax
+        template<typename Real>
+        DomainArray3d(const Vector3<Real>& localMin, const Vector3<Real>& localMax, const Vector3<Real>& cellSize,
+            int _ghostWidth, T value = T()):
+            DataSetImplementation<T, Vector3<int> >(getFullSize(getNumCells(localMin, localMax, cellSize), _ghostWidth),
+                internal::volume(getFullSize(getNumCells(localMin, localMax, cellSize), _ghostWidth)), value),
+            numCells(getNumCells(localMin, localMax, cellSize)),
+            ghostWidth(_ghostWidth)
+        {
+        }
+
+        // Get number of cells of the domain, width of ghost layers,
+        // size including ghost layers and total number of elements
+        IndexType getNumCells() const
+        {
+            return numCells;
+        }
+
+        int getGhostWidth() const
+        {
+            return ghostWidth;
+        }
+
+        IndexType getSize() const
+        {
+            return size;
+        }
+
+        long long getNumElements() const
+        {
+            return rawSize;
+        }
+
+        // Access the value by index without checking the index
+        ValueType& operator()(int i, int j, int k)
+        {
+            isDirty = true;
+            return raw[((long long)(i + ghostWidth) * size.y + j + ghostWidth) * size.z + k + ghostWidth];
+        }
+
+        const ValueType& operator()(int i, int j, int k) const
+        {
+            return raw[((long long)(i + ghostWidth) * size.y + j + ghostWidth) * size.z + k + ghostWidth];
+        }
+
+        ValueType& operator()(IndexType index)
+        {
+            return operator()(index.x, index.y, index.z);
+        }
+
+        const ValueType& operator()(IndexType index) const
+        {
+            return operator()(index.x, index.y, index.z);
+        }
+
+        // Access the value by index with checking the index
+        ValueType& element(int i, int j, int k)
+        {
+            if (isInRange(i, j, k))
+                return operator()(i, j, k);
+            else
+                PICMDK_THROW(OutOfRangeException, ("index " + toString(IndexType(i, j, k)) + " is out of range for DomainArray3d of " + toString(numCells) + " cells with ghost width " + toString(ghostWidth)));
+        }
+
+        const ValueType& element(int i, int j, int k) const
+        {
+            if (isInRange(i, j, k))
+                return operator()(i, j, k);
+            else
+                PICMDK_THROW(OutOfRangeException, ("index " + toString(IndexType(i, j, k)) + " is out of range for DomainArray3d of " + toString(numCells) + " cells with ghost width " + toString(ghostWidth)));
+        }
+
+        ValueType& element(IndexType index)
+        {
+            return element(index.x, index.y, index.z);
+        }
+
+        const ValueType& element(IndexType index) const
+        {
+            return element(index.x, index.y, index.z);
+        }
+
+    protected:
+
+        // Members of the dependent base class
+        using DataSetImplementation<T, Vector3<int> >::isDirty;
+        using DataSetImplementation<T, Vector3<int> >::size;
+        using DataSetImplementation<T, Vector3<int> >::raw;
+        using DataSetImplementation<T, Vector3<int> >::rawSize;
+
+    private:
+
+        IndexType numCells;
+        int ghostWidth;
+
+        static IndexType getFullSize(IndexType numCells, int ghostWidth)
+        {
+            return numCells + IndexType(2 * ghostWidth, 2 * ghostWidth, 2 * ghostWidth);
+        }
+
+        template<typename Real>
+        static IndexType getNumCells(const Vector3<Real>& localMin, const Vector3<Real>& localMax, const Vector3<Real>& cellSize)
+        {
+            Vector3<Real> numCells = (localMax - localMin) / cellSize;
+            return IndexType((int)(numCells.x + (Real)0.5), (int)(numCells.y + (Real)0.5), (int)(numCells.z + (Real)0.5));
+        }
+
+        bool isInRange(int i, int j, int k) const
+        {
+            return (i >= -ghostWidth) && (i < numCells.x + ghostWidth) && (j >= -ghostWidth) && (j < numCells.y + ghostWidth) &&
+                (k >= -ghostWidth) && (k < numCells.z + ghostWidth);
+        }
+
+        // Implementation of DataSetBase interface
+        virtual long long getSliceNumElements() const
+        {
+            return (long long)size.y * size.z;
+        }
+
+        virtual bool getGhostLayout(Vector3<int>& fullSize, int& _ghostWidth) const
+        {
+            fullSize = size;
+            _ghostWidth = ghostWidth;
+            return true;
+        }
+    };
+
+    // Interface of InterData::ParticleList<Record> class for module developers.
+    // The class represents a growable list of records, e.g. data of selected or escaping particles.
+    // Records are stored in chunks, so that appending never moves the existing records.
+    // Each thread appends to its own copy without locks, the copies are concatenated
+    // during synchronization, so only Gather and AllGather are supported and the imports must be Array<Record>.
+    // Optionally records are spilled to a file once their number reaches a cap, spilled records are not synchronized.
+    template<typename Record>
+    class ParticleList : public DataSetBase {
+    public:
+        typedef Record ValueType;
+        typedef long long IndexType;
+
+        ParticleList():
+            numRecords(0),
+            chunkNumRecords(std::max(chunkSizeBytes / (int)sizeof(Record), 1)),
+            maxNumRecords(0),
+            numSpilledRecords(0)
+        {
+        }
+
+        virtual ~ParticleList()
+        {
+            for (size_t i = 0; i < chunks.size(); i++)
+                delete[] chunks[i];
+        }
+
+        // Append the record, a new chunk is allocated in case all are full
+        void append(const Record& record)
+        {
+            isDirty = true;
+            if (numRecords == (long long)chunks.size() * chunkNumRecords)
+                chunks.push_back(new Record[chunkNumRecords]);
+            chunks[numRecords / chunkNumRecords][numRecords % chunkNumRecords] = record;
+            numRecords++;
+            if (numRecords == maxNumRecords)
+                spill();
+        }
+
+        // Get number of records in memory
+        IndexType getSize() const
+        {
+            return numRecords;
+        }
+
+        // Access the record by index without checking the index
+        Record& operator()(IndexType index)
+        {
+            isDirty = true;
+            return chunks[index / chunkNumRecords][index % chunkNumRecords];
+        }
+
+        const Record& operator()(IndexType index) const
+        {
+            return chunks[index / chunkNumRecords][index % chunkNumRecords];
+        }
+
+        // Remove all records from memory, the chunks are kept for reuse
+        void clear()
+        {
+            isDirty = true;
+            numRecords = 0;
+        }
+
+        // Append records to the given binary file each time their number reaches maxNumRecords, 0 disables it.
+        // The file name must be unique for each copy of the dataset, e.g. contain the rank and the thread index
+        void setSpillFile(const std::string& fileName, long long _maxNumRecords)
+        {
+            spillFileName = fileName;
+            maxNumRecords = _maxNumRecords;
+        }
+
+        // Append all records in memory to the spill file and remove them from memory
+        void spill()
+        {
+            std::ofstream file(spillFileName.c_str(), std::ios::binary | std::ios::app);
+            for (long long begin = 0; begin < numRecords; begin += chunkNumRecords)
+                file.write((const char*)chunks[begin / chunkNumRecords],
+                    std::min((long long)chunkNumRecords, numRecords - begin) * sizeof(Record));
+            if (!file)
+                PICMDK_THROW(FileException, ("unable to write particle list to file '" + spillFileName + "'"));
+            numSpilledRecords += numRecords;
+            clear();
+        }
+
+        long long getNumSpilledRecords() const
+        {
+            return numSpilledRecords;
+        }
+
+        // Implementation of DataSetBase interface, raw data is a contiguous copy of the records
+        virtual void* getRaw()
+        {
+            packedRecords.resize(numRecords);
+            if (numRecords)
+                packRaw((char*)&packedRecords[0]);
+            return numRecords ? &packedRecords[0] : 0;
+        }
+
+        virtual long long getRawSizeBytes() const
+        {
+            return numRecords * (long long)sizeof(Record);
+        }
+
+    private:
+
+        static const int chunkSizeBytes = 64 * 1024;
+
+        std::vector<Record*> chunks;
+        long long numRecords;
+        int chunkNumRecords;
+        long long maxNumRecords;
+        long long numSpilledRecords;
+        std::string spillFileName;
+        std::vector<Record> packedRecords; // for getRaw()
+
+        // Implementation of DataSetBase interface
+        virtual void packRaw(char* destination)
+        {
+            for (long long begin = 0; begin < numRecords; begin += chunkNumRecords)
+                std::memcpy(destination + begin * sizeof(Record), chunks[begin / chunkNumRecords],
+                    std::min((long long)chunkNumRecords, numRecords - begin) * sizeof(Record));
+        }
+
+        // Cleared after synchronization without marking as modified
+        virtual bool clearRaw()
+        {
+            numRecords = 0;
+            return true;
+        }
+
+        // Copy and assignment are forbidden
+        ParticleList(const ParticleList&);
+        ParticleList& operator=(const ParticleList&);
     };
 
 
 private:
 
+    // Synchronizer defines how copies of a dataset are combined.
+    // Thread-level stage is done by run() for the given number of elements starting from
+    // the given pointers, so that it can be done chunk by chunk; process-level stage is done
+    // by an MPI reduction with the returned parameters, then the result or its part is post-processed by finalize().
     class SynchronizerBase {
     public:
         virtual ~SynchronizerBase() {}
-        virtual void run(void* destination, const void* source) = 0;
+        virtual void run(void* destination, const void* source, long long numElements) = 0;
+        virtual void finalize(void* /*data*/, long long /*numElements*/, int /*numContributors*/) {}
+        virtual MPI_Op getMPIOp() const = 0;
+        virtual MPI_Datatype getMPIDatatype() const = 0;
+        virtual long long getMPICount() const = 0;
+        virtual int getElementSizeBytes() const = 0;
+        // For custom reductions the user function of the MPI operation, 0 otherwise.
+        // The operation and the datatype are created by InterData at plan creation and set by setMPIOp()
+        virtual MPI_User_function* getMPIUserFunction() const { return 0; }
+        virtual void setMPIOp(MPI_Op /*op*/, MPI_Datatype /*datatype*/) {}
     };
 
     template<typename T>
     class NoneSynchronizer : public InterData::SynchronizerBase {
     public:
-        virtual void run(void* destination, const void* source)
+        virtual void run(void* /*destination*/, const void* /*source*/, long long /*numElements*/)
+        {
+        }
+        virtual MPI_Op getMPIOp() const { return MPI_OP_NULL; }
+        virtual MPI_Datatype getMPIDatatype() const { return MPI_DATATYPE_NULL; }
+        virtual long long getMPICount() const { return 0; }
+        virtual int getElementSizeBytes() const { return sizeof(T); }
+    };
+
+    // Helper base class for reduction synchronizers,
+    // all operations are done component-wise on scalars of T
+    template<typename T>
+    class ReductionSynchronizer : public InterData::SynchronizerBase {
+    public:
+        typedef typename internal::ElementTraits<T>::Scalar Scalar;
+
+        ReductionSynchronizer(long long numElements, MPI_Op _op) :
+            numScalars(numElements * internal::ElementTraits<T>::numComponents),
+            op(_op)
+        {
+        }
+        virtual MPI_Op getMPIOp() const { return op; }
+        virtual MPI_Datatype getMPIDatatype() const { return internal::getMPIDatatype<Scalar>(); }
+        virtual long long getMPICount() const { return numScalars; }
+        virtual int getElementSizeBytes() const { return sizeof(T); }
+    protected:
+        long long numScalars;
+        MPI_Op op;
+
+        // Kernels take int counts, so longer ranges are reduced in parts
+        typedef void (*Kernel)(Scalar* dst, const Scalar* src, int n);
+        static void runKernel(Kernel kernel, void* destination, const void* source, long long numElements)
+        {
+            Scalar* dst = (Scalar*)destination;
+            const Scalar* src = (const Scalar*)source;
+            const long long maxCount = std::numeric_limits<int>::max();
+            long long count = numElements * internal::ElementTraits<T>::numComponents;
+            for (long long begin = 0; begin < count; begin += maxCount)
+                kernel(dst + begin, src + begin, (int)std::min(maxCount, count - begin));
+        }
+    };
+
+    template<typename T>
+    class SumSynchronizer : public ReductionSynchronizer<T> {
+    public:
+        typedef typename ReductionSynchronizer<T>::Scalar Scalar;
+        SumSynchronizer(long long numElements) :
+            ReductionSynchronizer<T>(numElements, MPI_SUM)
+        {
+        }
+        virtual void run(void* destination, const void* source, long long numElements)
+        {
+            ReductionSynchronizer<T>::runKernel(&kernels::sum, destination, source, numElements);
+        }
+    };
+
+    template<typename T>
+    class ProductSynchronizer : public ReductionSynchronizer<T> {
+    public:
+        typedef typename ReductionSynchronizer<T>::Scalar Scalar;
+        ProductSynchronizer(long long numElements) :
+            ReductionSynchronizer<T>(numElements, MPI_PROD)
+        {
+        }
+        virtual void run(void* destination, const void* source, long long numElements)
+        {
+            ReductionSynchronizer<T>::runKernel(&kernels::product, destination, source, numElements);
+        }
+    };
+
+    template<typename T>
+    class MaxSynchronizer : public ReductionSynchronizer<T> {
+    public:
+        typedef typename ReductionSynchronizer<T>::Scalar Scalar;
+        MaxSynchronizer(long long numElements) :
+            ReductionSynchronizer<T>(numElements, MPI_MAX)
+        {
+        }
+        virtual void run(void* destination, const void* source, long long numElements)
+        {
+            ReductionSynchronizer<T>::runKernel(&kernels::max, destination, source, numElements);
+        }
+    };
+
+    template<typename T>
+    class MinSynchronizer : public ReductionSynchronizer<T> {
+    public:
+        typedef typename ReductionSynchronizer<T>::Scalar Scalar;
+        MinSynchronizer(long long numElements) :
+            ReductionSynchronizer<T>(numElements, MPI_MIN)
+        {
+        }
+        virtual void run(void* destination, const void* source, long long numElements)
         {
+            ReductionSynchronizer<T>::runKernel(&kernels::min, destination, source, numElements);
         }
     };
 
+    // Average is computed as sum divided by the total number of copies
     template<typename T>
-    class AddSynchronizer : public InterData::SynchronizerBase {
+    class AverageSynchronizer : public SumSynchronizer<T> {
+    public:
+        typedef typename ReductionSynchronizer<T>::Scalar Scalar;
+        AverageSynchronizer(long long numElements) :
+            SumSynchronizer<T>(numElements)
+        {
+        }
+        virtual void finalize(void* data, long long numElements, int numContributors)
+        {
+            Scalar* d = (Scalar*)data;
+            for (long long i = 0; i < numElements * internal::ElementTraits<T>::numComponents; i++)
+                d[i] /= (Scalar)numContributors;
+        }
+    };
+
+    // The MPI operation is created by InterData once for each pair of T and Reduction, as identified
+    // by reduceMPI, so that all datasets with the same reduction are packed into one bucket
+    template<typename T, class Reduction>
+    class CustomSynchronizer : public InterData::SynchronizerBase {
     public:
-        AddSynchronizer(int _numElements) :
-            numElements(_numElements)
+        CustomSynchronizer(long long _numElements) :
+            numElements(_numElements),
+            op(MPI_OP_NULL),
+            datatype(MPI_DATATYPE_NULL)
+        {
+        }
+        virtual void run(void* destination, const void* source, long long numElements)
         {
+            reduce(source, destination, numElements);
         }
-        virtual void run(void* destination, const void* source)
+        virtual MPI_Op getMPIOp() const { return op; }
+        virtual MPI_Datatype getMPIDatatype() const { return datatype; }
+        virtual long long getMPICount() const { return numElements; }
+        virtual int getElementSizeBytes() const { return sizeof(T); }
+        virtual MPI_User_function* getMPIUserFunction() const { return &reduceMPI; }
+        virtual void setMPIOp(MPI_Op _op, MPI_Datatype _datatype)
+        {
+            op = _op;
+            datatype = _datatype;
+        }
+    private:
+        long long numElements;
+        MPI_Op op;
+        MPI_Datatype datatype;
+
+        static void reduce(const void* source, void* destination, long long numElements)
         {
             T* dst = (T*)destination;
             const T* src = (const T*)source;
-            for (int i = 0; i < numElements; i++)
-                dst[i] += src[i];
+            Reduction reduction;
+            for (long long i = 0; i < numElements; i++)
+                reduction(dst[i], src[i]);
+        }
+
+        static void reduceMPI(void* source, void* destination, int* numElements, MPI_Datatype* /*datatype*/)
+        {
+            reduce(source, destination, *numElements);
+        }
+    };
+
+    template<typename Key, typename Payload>
+    struct MaxLocReduction {
+        void operator()(KeyPayload<Key, Payload>& destination, const KeyPayload<Key, Payload>& source) const
+        {
+            if ((source.key > destination.key) || ((source.key == destination.key) && (source.payload < destination.payload)))
+                destination = source;
+        }
+    };
+
+    template<typename Key, typename Payload>
+    struct MinLocReduction {
+        void operator()(KeyPayload<Key, Payload>& destination, const KeyPayload<Key, Payload>& source) const
+        {
+            if ((source.key < destination.key) || ((source.key == destination.key) && (source.payload < destination.payload)))
+                destination = source;
         }
-    private:
-        int numElements;
     };
 
+    // Synchronizer is chosen by the type of elements, so that reductions are instantiated
+    // only for the types supporting them
     template<class DataSet>
     SynchronizerBase* createSynchronizer(DataSet* dataSet, SynchronizationMode mode)
+    {
+        return createSynchronizer((const typename DataSet::ValueType*)0, dataSet->getNumElements(), mode);
+    }
+
+    template<typename T>
+    SynchronizerBase* createSynchronizer(const T*, long long numElements, SynchronizationMode mode)
     {
         switch (mode.operation) {
-            case SynchronizationMode::None: return new NoneSynchronizer<DataSet::ValueType>;
-            case SynchronizationMode::Add: return new AddSynchronizer<DataSet::ValueType>(dataSet->getNumElements());
+            case SynchronizationMode::None: return new NoneSynchronizer<T>;
+            case SynchronizationMode::Sum: return new SumSynchronizer<T>(numElements);
+            case SynchronizationMode::Product: return new ProductSynchronizer<T>(numElements);
+            case SynchronizationMode::Max: return new MaxSynchronizer<T>(numElements);
+            case SynchronizationMode::Min: return new MinSynchronizer<T>(numElements);
+            case SynchronizationMode::Average: return new AverageSynchronizer<T>(numElements);
+            case SynchronizationMode::Gather: return new NoneSynchronizer<T>;
+            case SynchronizationMode::AllGather: return new NoneSynchronizer<T>;
+            case SynchronizationMode::Copy: return new NoneSynchronizer<T>;
+            case SynchronizationMode::Custom: PICMDK_THROW(SynchronizationException, ("Custom synchronization requires registerCustomExport()"));
+            case SynchronizationMode::MaxLoc:
+            case SynchronizationMode::MinLoc: PICMDK_THROW(SynchronizationException, ("MaxLoc and MinLoc synchronization requires elements of type KeyPayload"));
             default: PICMDK_THROW(NotImplementedException, ("Synchronization mode is not currently implemented"));
         }
     }
 
+    // Of reductions elements of type KeyPayload support only MaxLoc and MinLoc, done as custom reductions
+    template<typename Key, typename Payload>
+    SynchronizerBase* createSynchronizer(const KeyPayload<Key, Payload>*, long long numElements, SynchronizationMode mode)
+    {
+        typedef KeyPayload<Key, Payload> ValueType;
+        switch (mode.operation) {
+            case SynchronizationMode::None: return new NoneSynchronizer<ValueType>;
+            case SynchronizationMode::Gather: return new NoneSynchronizer<ValueType>;
+            case SynchronizationMode::AllGather: return new NoneSynchronizer<ValueType>;
+            case SynchronizationMode::Copy: return new NoneSynchronizer<ValueType>;
+            case SynchronizationMode::MaxLoc: return new CustomSynchronizer<ValueType, MaxLocReduction<Key, Payload> >(numElements);
+            case SynchronizationMode::MinLoc: return new CustomSynchronizer<ValueType, MinLocReduction<Key, Payload> >(numElements);
+            default: PICMDK_THROW(SynchronizationException, ("elements of type KeyPayload support only MaxLoc and MinLoc reductions"));
+        }
+    }
+
+    // Finalizer is applied to exported datasets after their data is taken for synchronization,
+    // like run() of synchronizers it works on the given number of elements
     class FinalizerBase {
     public:
         virtual ~FinalizerBase() {}
-        virtual void run(void* data) = 0;
+        virtual void run(void* data, long long numElements) = 0;
     };
 
     template<typename T>
     class KeepFinalizer : public InterData::FinalizerBase {
     public:
-        virtual void run(void* data)
+        virtual void run(void* /*data*/, long long /*numElements*/)
         {
         }
     };
 
+    // Sets elements to the given value, the identity of the reduction
     template<typename T>
     class ClearFinalizer : public InterData::FinalizerBase {
     public:
-        ClearFinalizer(int _numElements) :
-            numElements(_numElements)
+        ClearFinalizer(const T& _value = T()):
+            value(_value)
         {
         }
-        virtual void run(void* data)
+        virtual void run(void* data, long long numElements)
         {
             T* d = (T*)data;
-            for (int i = 0; i < numElements; i++)
-                d[i] += (T)0;
+            for (long long i = 0; i < numElements; i++)
+                d[i] = value;
         }
     private:
-        int numElements;
+        T value;
     };
 
+    // Value of cleared elements: 0 for all types except KeyPayload
+    template<typename T>
+    static T getIdentity(const T*, SynchronizationMode /*mode*/)
+    {
+        return T();
+    }
+
+    // For MaxLoc and MinLoc the key loses all comparisons
+    template<typename Key, typename Payload>
+    static KeyPayload<Key, Payload> getIdentity(const KeyPayload<Key, Payload>*, SynchronizationMode mode)
+    {
+        KeyPayload<Key, Payload> identity;
+        if (mode.operation == SynchronizationMode::MaxLoc)
+            identity.key = std::numeric_limits<Key>::is_integer ? std::numeric_limits<Key>::min() : -std::numeric_limits<Key>::max();
+        else if (mode.operation == SynchronizationMode::MinLoc)
+            identity.key = std::numeric_limits<Key>::max();
+        return identity;
+    }
+
+    // Make the dataset use data of the given export, which is its copy registered by another thread
+    template<class DataSet>
+    void shareRaw(DataSet* dataSet, int ownerIdx)
+    {
+        DataSet* typedOwner = dynamic_cast<DataSet*>(exportData[ownerIdx].dataSet);
+        if (!typedOwner || (typedOwner->getRawSizeBytes() != dataSet->getRawSizeBytes()))
+            PICMDK_THROW(SynchronizationException, ("shared dataset '" + exportData[ownerIdx].name + "' has copies of different types or sizes"));
+        dataSet->setRaw((typename DataSet::ValueType*)typedOwner->getRaw());
+    }
+
+    // Move data of the dataset to the arena, so that it is cache-line-aligned
+    // and allocated by the calling thread
+    template<class DataSet>
+    void moveToArena(DataSet* dataSet)
+    {
+        if (dataSet->getRawSizeBytes())
+            dataSet->changeRaw((typename DataSet::ValueType*)arena.allocate(dataSet->getRawSizeBytes()));
+    }
+
+    // Place data of the dataset to lazily allocated pages, the current data is discarded
     template<class DataSet>
-    FinalizerBase* createFinalizer(DataSet* dataSet, SynchronizationMode mode)
+    void moveToPages(DataSet* dataSet)
+    {
+        if (dataSet->getRawSizeBytes())
+            dataSet->setRaw((typename DataSet::ValueType*)arena.allocatePages(dataSet->getRawSizeBytes()));
+    }
+
+    template<class DataSet>
+    FinalizerBase* createFinalizer(DataSet* /*dataSet*/, SynchronizationMode mode)
     {
         switch (mode.finalization) {
-            case SynchronizationMode::Keep: return new KeepFinalizer<DataSet::ValueType>;
-            case SynchronizationMode::Clear: return new ClearFinalizer<DataSet::ValueType>(dataSet->getNumElements());
+            case SynchronizationMode::Keep: return new KeepFinalizer<typename DataSet::ValueType>;
+            case SynchronizationMode::Clear: return new ClearFinalizer<typename DataSet::ValueType>(getIdentity((const typename DataSet::ValueType*)0, mode));
             default: PICMDK_THROW(NotImplementedException, ("Finalization mode is not currently implemented"));
         }
     }
@@ -535,8 +1476,19 @@ private:
     struct ExportDescription {
         DataSetBase* dataSet;
         std::string name;
+        Handler* handler; // handler which registered the copy
         int threadIdx;
         bool isGlobal;
+        SynchronizationMode::Locality locality;
+        int root;
+        SynchronizationMode::Operation operation;
+        bool isShared; // whether the copy is used by all threads
+        bool isLazy; // whether the copy has lazily allocated pages
+        bool isCleared; // whether the copy has Clear finalization
+        SynchronizationMode::Schedule schedule;
+        int synchronizationIdx; // index in synchronizationData
+        std::vector<bool> isPageTouched; // for lazy copies, updated at each synchronization
+        std::vector<DataSetBase*> sharedCopies; // copies of other threads using data of this one
         SynchronizerBase* synchronizer;
         FinalizerBase* finalizer;
         void* destination;
@@ -545,20 +1497,216 @@ private:
     struct ImportDescrtiption {
         DataSetBase* dataSet;
         std::string name;
+        Handler* handler; // handler which registered the import
+        int synchronizationIdx; // index in synchronizationData
     };
 
     void registerExport(DataSetBase* dataSet, const std::string& name, SynchronizationMode mode,
         SynchronizerBase* synchronizer, FinalizerBase* finalizer);
     void registerImport(DataSetBase* dataSet, const std::string& name);
+    // Index of the shared export the given one is a copy of for another thread, -1 if it is not a copy
+    int findSharedOwner(const std::string& name, SynchronizationMode mode) const;
+
+    // All copies of exported datasets with the same name and imports matching them.
+    // Copies are first reduced into buffer, for global synchronization buffer
+    // is then reduced between processes into result.
+    // For local synchronization buffer and result point to storage, for global
+    // they point to the packed buffers of the bucket the synchronization belongs to.
+    // ReduceScatter synchronizations are not bucketed, buffer points to storage and
+    // result to the slab of this process in recvStorage. Halo synchronizations are not bucketed
+    // either, buffer and result point to storage, where the ghost layers are exchanged in place.
+    // For gathers copies are concatenated in storage and then gathered directly
+    // to the first import, result points to the gathered data on receiving processes.
+    // Raw data of exports and imports of reductions is resolved in finalizeInit(),
+    // so these datasets must not be resized afterwards.
+    struct SynchronizationDescription {
+        std::string name;
+        std::vector<int> exportIdx; // indexes in exportData
+        std::vector<int> importIdx; // indexes in importData
+        SynchronizerBase* synchronizer; // of the first export
+        std::vector<char*> sources; // raw data of exports, for reductions
+        std::vector<char*> destinations; // raw data of imports, for reductions
+        SynchronizationMode::Operation operation;
+        bool isGlobal;
+        SynchronizationMode::Locality locality; // Local for all non-global synchronizations
+        int root;
+        SynchronizationMode::Schedule schedule;
+        bool isActive; // whether it is done in the current synchronization
+        bool wasDirty; // whether some copy was modified for the last done synchronization
+        int numContributors; // total number of reduced copies, for all processes in case of global
+        long long sizeBytes; // size of the whole data
+        long long resultOffsetBytes, resultSizeBytes; // part of the data in result, all data except for ReduceScatter
+        int sliceBegin, sliceEnd; // slices of the first index in result, for ReduceScatter
+        Vector3<int> fullSize; // size including ghost layers, for Halo
+        int ghostWidth; // for Halo
+        std::vector<char> haloSendBuffer, haloRecvBuffer; // packed layers, for Halo
+        int bucketIdx; // index in synchronizationBuckets or -1 for local synchronization, gathers, ReduceScatter and Halo
+        long long bucketOffsetBytes; // offset of the data in the packed buffers of the bucket
+        std::vector<char> storage;
+        char* buffer;
+        char* result;
+        std::vector<int> recvCounts, displs; // for each process, in bytes for global gathers, in datatype elements for ReduceScatter
+        std::vector<char> recvStorage; // gathered data in case there are no imports, the slab for ReduceScatter
+        MPI_Request request; // for asynchronous global gathers and ReduceScatter
+        bool isPending;
+    };
+
+    // Global synchronizations with the same MPI operation, datatype, schedule and receivers,
+    // their data is packed contiguously so that a single collective is done per bucket.
+    // The collective is done in case any of the synchronizations is active, the others
+    // take part with outdated data, but are not finished.
+    // With double buffering the collective in flight is moved to the previous* members
+    // when the next one is started, the previous one is always completed first.
+    struct SynchronizationBucket {
+        MPI_Op op;
+        MPI_Datatype datatype;
+        SynchronizationMode::Schedule schedule;
+        SynchronizationMode::Locality locality; // Global or Root
+        int root;
+        long long count; // total count in elements of datatype, the collective is split into parts of at most maxCollectiveCount
+        std::vector<int> synchronizationIdx; // indexes in synchronizationData
+        std::vector<char> sendBuffer;
+        std::vector<char> recvBuffer;
+        std::vector<MPI_Request> requests; // for each part of the collective
+        bool isPending; // whether the collective is started, but not yet completed
+        std::vector<int> activeIdx; // indexes in synchronizationData of synchronizations finished by the collective
+        std::vector<char> previousSendBuffer, previousRecvBuffer; // empty without double buffering
+        std::vector<MPI_Request> previousRequests;
+        bool isPreviousPending;
+        std::vector<int> previousActiveIdx;
+        // For node-level reduction the packed data of each process of the node is in a shared window
+        // instead of sendBuffer, the first process of the node also holds the reduced data of the node
+        // and the result of the collective between nodes
+        MPI_Win window; // MPI_WIN_NULL if node-level reduction is not used for the bucket
+        std::vector<char*> nodeBuffers; // for each process of the node
+        char* nodeResult;
+    };
+
+    // Part of a reduced synchronization, the thread-level stage is done
+    // chunk by chunk with chunks distributed between threads
+    struct ReductionChunk {
+        int synchronizationIdx;
+        long long offsetBytes;
+        int numElements;
+    };
 
     std::vector<ExportDescription> exportData;
     std::vector<ImportDescrtiption> importData;
+    std::map<std::string, std::vector<int> > exportIdxByName; // indexes in exportData of all copies of each dataset
+    std::vector<SynchronizationDescription> synchronizationData;
+    std::map<std::string, int> synchronizationIdxByName; // index in synchronizationData of each dataset
+    std::map<const Handler*, std::vector<int> > synchronizationIdxByHandler; // indexes in synchronizationData of imports of each handler
+    std::vector<SynchronizationBucket> synchronizationBuckets;
+    std::vector<ReductionChunk> reductionChunks;
+    long long reductionSizeBytes; // total size of all reduced copies
+    std::vector<int> lazyExportIdx; // indexes in exportData of reduced lazy copies
+    std::vector<int> neighbourRanks; // lower and upper neighbours along x, y, z or MPI_PROC_NULL, for Halo
     Handler* currentHandler;
+    Communicator* communicator;
+    std::auto_ptr<Communicator> nodeCommunicator; // processes sharing memory with this one, for node-level reduction
+    std::auto_ptr<Communicator> leaderCommunicator; // first processes of all nodes, empty on the other processes
+    bool isAsynchronous;
+    bool isDirtyTracking;
+    bool isNodeReduction;
+    bool isDoubleBuffering;
+    MemoryArena arena; // storage of all registered datasets
+    std::map<MPI_User_function*, MPI_Op> customOps; // MPI operations of custom reductions by their user functions
+    std::map<int, MPI_Datatype> customDatatypes; // contiguous datatypes of elements of custom reductions by size in bytes
 
     // These methods are for Controller to call
     void setCurrentHandler(Handler* handler);
+    // Remove the exports and imports registered by the given handlers, e.g. in case their initialization failed.
+    // Must be called before finalizeInit()
+    void unregisterHandlers(const std::set<const Handler*>& handlers);
+    void setCommunicator(Communicator* communicator);
     void finalizeInit();
+    // In asynchronous mode global synchronizations are only started here and
+    // completed by the wait methods, otherwise everything is completed here
+    void setAsynchronous(bool asynchronous);
+    // Synchronize all datasets regardless of their schedules
     void synchronizeAll();
+    // Synchronize datasets scheduled for the given event (Event::numEvents for the unbound ones) and iteration
+    void synchronize(Event::Type event, int iteration);
+    // With dirty tracking synchronizations are skipped when no copy was modified since the last one,
+    // then the imports keep their values and so should not be modified by the importing handlers.
+    // Modification state of global datasets is agreed between processes with one small collective
+    void setDirtyTracking(bool dirtyTracking);
+    // With node-level reduction global reductions to all processes are first done between processes
+    // of each node through shared memory, then only the first process of each node takes part in
+    // the collective. Must be set before finalizeInit(), has no effect when each node runs one process
+    void setNodeReduction(bool nodeReduction);
+    // With double buffering in asynchronous mode global reductions use two sets of buffers,
+    // so that starting a synchronization does not wait for the collective of the previous one.
+    // Results are still delivered to the imports in order. Must be set before finalizeInit()
+    void setDoubleBuffering(bool doubleBuffering);
+    // Complete synchronizations of all datasets imported by the given handler
+    void waitSynchronization(const Handler* handler);
+    void waitSynchronizationAll();
+    // Set the Cartesian grid of domains, the processes are numbered in row-major order of domain indexes
+    // as for MPI_Cart_create without reordering, the communicator must be set before
+    void setDomainDecomposition(const Vector3<int>& numDomains, const Vector3<int>& isPeriodic);
+    // Back the arena with huge pages, affects only datasets registered afterwards
+    void setUseHugePages(bool useHugePages);
+    // Write size and placement of each registered dataset
+    void writeMemoryUsage(std::ostream& stream) const;
+
+    // Return index in synchronizationData for the given name or -1 if there is none
+    int findSynchronization(const std::string& name) const;
+    // Group global synchronizations into buckets and set buffers of all synchronizations
+    void createSynchronizationPlan();
+    // Set the MPI operation and datatype of a custom reduction to the synchronizers of all copies,
+    // creating them on first use
+    void setCustomMPIOp(SynchronizationDescription& sync);
+    // Allocate shared windows of buckets for node-level reduction, free the windows of previous buckets
+    void createNodeReduction();
+    void freeNodeReduction();
+    // Reduce the data of all processes of the node and start the collective between nodes
+    void startNodeReduction(SynchronizationBucket& bucket);
+    // Complete synchronizations whose buffers are reused by the next one
+    void waitReusedBuffers();
+    // Do the collective of the bucket in parts of at most maxCollectiveCount elements of the datatype,
+    // as MPI counts are int, in asynchronous mode the parts are started and completed by completeBucket()
+    void reduceBucket(SynchronizationBucket& bucket, Communicator* bucketCommunicator, char* sendBuffer, char* recvBuffer);
+    // Wait for the collectives of the bucket and finish their synchronizations, the previous one first
+    void completeBucket(SynchronizationBucket& bucket);
+    void completePreviousBucket(SynchronizationBucket& bucket);
+    // Move the collective in flight to the previous buffers, so that the next one can be started
+    void swapBucketBuffers(SynchronizationBucket& bucket);
+    // Finish the given synchronizations of a bucket with the result in recvBuffer
+    void finishBucket(std::vector<char>& recvBuffer, const std::vector<int>& activeIdx);
+    // Post-process the reduced data and copy it to the imports
+    void finishSynchronization(SynchronizationDescription& sync);
+    bool isScheduled(const SynchronizationDescription& sync, Event::Type event, int iteration) const;
+    // Deactivate synchronizations which would not change the imports
+    void skipCleanSynchronizations();
+    bool isDirty(const SynchronizationDescription& sync) const;
+    // Do the active synchronizations
+    void startSynchronization();
+    void reduceChunk(const ReductionChunk& chunk);
+    bool isTouched(const ExportDescription& exportDescription, long long offsetBytes, int sizeBytes) const;
+    // Concatenate copies of the dataset and start gathering them
+    void startGather(SynchronizationDescription& sync);
+    // Wait for the gather to complete and copy the gathered data to the other imports
+    void completeGather(SynchronizationDescription& sync);
+    // Start reduction of the dataset with slabs of the result scattered between processes
+    void startReduceScatter(SynchronizationDescription& sync);
+    void completeReduceScatter(SynchronizationDescription& sync);
+    // Exchange ghost layers of the dataset with neighbouring domains
+    void exchangeHalo(SynchronizationDescription& sync);
+    // Send the layer [sendBegin, sendBegin + ghostWidth) along the dimension to dest and
+    // receive the layer [recvBegin, recvBegin + ghostWidth) from source, writing or accumulating it
+    void exchangeHaloLayer(SynchronizationDescription& sync, int dim, const Vector3<int>& layerBegin,
+        const Vector3<int>& layerEnd, int sendBegin, int dest, int recvBegin, int source, bool isAccumulated);
+    // Copy the given box of the dataset in storage to a contiguous buffer or back, writing or accumulating it
+    void copyBox(SynchronizationDescription& sync, const Vector3<int>& begin, const Vector3<int>& end,
+        char* boxBuffer, bool isPacking, bool isAccumulated);
+
+    template<class Adapter>
+    friend class Controller;
+
+    // Copy and assignment are forbidden
+    InterData(const InterData&);
+    InterData& operator=(const InterData&);
 
 };
 
@@ -1,8 +1,10 @@
 #ifndef PICMDK_MPIWRAPPER_H
 #define PICMDK_MPIWRAPPER_H
 
-////
+// MPI is used unless PICMDK_NO_MPI is defined, then it is simulated for a single process
+#ifndef PICMDK_NO_MPI
 #define PICMDK_USE_MPI
+#endif
 #ifdef PICMDK_USE_MPI
 
 #include <mpi.h>
@@ -14,32 +16,94 @@
 // Stubs for employed MPI types and constants
 typedef int MPI_Comm;
 typedef int MPI_Status;
+typedef int MPI_Request;
+typedef int MPI_Win;
+typedef int MPI_Info;
+typedef long MPI_Aint;
 const MPI_Comm MPI_COMM_WORLD = 0;
-enum MPI_Datatype { MPI_MPI_DATATYPE_NULL, MPI_CHAR, MPI_INT, MPI_FLOAT, MPI_DOUBLE };
+const MPI_Comm MPI_COMM_NULL = -1;
+const MPI_Request MPI_REQUEST_NULL = 0;
+const MPI_Win MPI_WIN_NULL = 0;
+const MPI_Info MPI_INFO_NULL = 0;
+const int MPI_PROC_NULL = -1;
+const int MPI_UNDEFINED = -32766;
+const int MPI_COMM_TYPE_SHARED = 1;
+const int MPI_MODE_NOCHECK = 1024;
+// Derived datatypes created by MPI_Type_contiguous follow the predefined ones
+typedef int MPI_Datatype;
+const MPI_Datatype MPI_DATATYPE_NULL = 0;
+const MPI_Datatype MPI_BYTE = 1;
+const MPI_Datatype MPI_CHAR = 2;
+const MPI_Datatype MPI_INT = 3;
+const MPI_Datatype MPI_UNSIGNED = 4;
+const MPI_Datatype MPI_LONG = 5;
+const MPI_Datatype MPI_LONG_LONG = 6;
+const MPI_Datatype MPI_FLOAT = 7;
+const MPI_Datatype MPI_DOUBLE = 8;
 enum MPI_Op {
     MPI_OP_NULL, MPI_MAX, MPI_MIN, MPI_SUM, MPI_PROD, MPI_LAND,
     MPI_BAND, MPI_LOR, MPI_BOR, MPI_LXOR, MPI_BXOR, MPI_MINLOC, MPI_MAXLOC, MPI_REPLACE
 };
+typedef void MPI_User_function(void *invec, void *inoutvec, int *len, MPI_Datatype *datatype);
 
 
 int MPI_Comm_rank(MPI_Comm comm, int* rank);
 int MPI_Comm_size(MPI_Comm comm, int* size);
 void MPI_Comm_dup(MPI_Comm comm, MPI_Comm* newcomm);
+int MPI_Comm_split(MPI_Comm comm, int color, int key, MPI_Comm *newcomm);
+int MPI_Comm_split_type(MPI_Comm comm, int split_type, int key, MPI_Info info, MPI_Comm *newcomm);
+int MPI_Comm_free(MPI_Comm *comm);
 int MPI_Barrier(MPI_Comm comm);
 int MPI_Send(const void *buf, int count, MPI_Datatype datatype,
     int dest, int tag, MPI_Comm comm);
 int MPI_Recv(void *buf, int count,
-    MPI_Datatype datatype, int source, int tag, MPI_Status *status, MPI_Comm comm);
+    MPI_Datatype datatype, int source, int tag, MPI_Comm comm, MPI_Status *status);
 int MPI_Sendrecv(const void *sendbuf, int sendcount,
     MPI_Datatype sendtype, int dest, int sendtag, void *recvbuf, int recvcount,
-    MPI_Datatype recvtype, int source, int recvtag, MPI_Status *status, MPI_Comm comm);
+    MPI_Datatype recvtype, int source, int recvtag, MPI_Comm comm, MPI_Status *status);
 int MPI_Bcast(void *buffer, int count, MPI_Datatype datatype, int root, MPI_Comm comm);
 int MPI_Gather(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
     void *recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm);
+int MPI_Gatherv(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+    void *recvbuf, const int *recvcounts, const int *displs, MPI_Datatype recvtype,
+    int root, MPI_Comm comm);
+int MPI_Allgather(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+    void *recvbuf, int recvcount, MPI_Datatype recvtype, MPI_Comm comm);
+int MPI_Allgatherv(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+    void *recvbuf, const int *recvcounts, const int *displs, MPI_Datatype recvtype,
+    MPI_Comm comm);
 int MPI_Reduce(const void *sendbuf, void *recvbuf,
     int count, MPI_Datatype datatype, MPI_Op op, int root, MPI_Comm comm);
 int MPI_Allreduce(const void *sendbuf, void *recvbuf,
     int count, MPI_Datatype datatype, MPI_Op op, MPI_Comm comm);
+int MPI_Reduce_scatter(const void *sendbuf, void *recvbuf, const int *recvcounts,
+    MPI_Datatype datatype, MPI_Op op, MPI_Comm comm);
+int MPI_Iallreduce(const void *sendbuf, void *recvbuf, int count,
+    MPI_Datatype datatype, MPI_Op op, MPI_Comm comm, MPI_Request *request);
+int MPI_Ireduce(const void *sendbuf, void *recvbuf, int count,
+    MPI_Datatype datatype, MPI_Op op, int root, MPI_Comm comm, MPI_Request *request);
+int MPI_Ireduce_scatter(const void *sendbuf, void *recvbuf, const int *recvcounts,
+    MPI_Datatype datatype, MPI_Op op, MPI_Comm comm, MPI_Request *request);
+int MPI_Igatherv(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+    void *recvbuf, const int *recvcounts, const int *displs, MPI_Datatype recvtype,
+    int root, MPI_Comm comm, MPI_Request *request);
+int MPI_Iallgatherv(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+    void *recvbuf, const int *recvcounts, const int *displs, MPI_Datatype recvtype,
+    MPI_Comm comm, MPI_Request *request);
+int MPI_Op_create(MPI_User_function *user_fn, int commute, MPI_Op *op);
+int MPI_Type_contiguous(int count, MPI_Datatype oldtype, MPI_Datatype *newtype);
+int MPI_Type_commit(MPI_Datatype *datatype);
+int MPI_Op_free(MPI_Op *op);
+int MPI_Type_free(MPI_Datatype *datatype);
+int MPI_Win_allocate_shared(MPI_Aint size, int disp_unit, MPI_Info info, MPI_Comm comm,
+    void *baseptr, MPI_Win *win);
+int MPI_Win_shared_query(MPI_Win win, int rank, MPI_Aint *size, int *disp_unit, void *baseptr);
+int MPI_Win_lock_all(int assert, MPI_Win win);
+int MPI_Win_unlock_all(MPI_Win win);
+int MPI_Win_sync(MPI_Win win);
+int MPI_Win_free(MPI_Win *win);
+int MPI_Wait(MPI_Request *request, MPI_Status *status);
+int MPI_Test(MPI_Request *request, int *flag, MPI_Status *status);
 
 
 #endif
@@ -0,0 +1,91 @@
+#ifndef PICMDK_MEMORYARENA_H
+#define PICMDK_MEMORYARENA_H
+
+
+#include <cstddef>
+#include <vector>
+
+
+namespace picmdk {
+
+
+// Arena for storage of InterData datasets.
+// Memory is given out in cache-line-aligned pieces of blocks owned by the calling
+// OpenMP thread, so that data of different threads never shares cache lines and
+// pages are first touched by the thread which uses them.
+// On Linux blocks are fresh anonymous mappings, elsewhere they come from the aligned allocator
+// and may reuse memory already touched by another thread, so first touch is not guaranteed.
+// Large pieces get dedicated blocks, with huge pages enabled blocks are
+// huge-page-aligned and advised to be backed by huge pages where supported.
+// Memory is freed on destruction of the arena, except for pieces given back by release().
+// Besides, the arena gives out lazily allocated page-aligned memory, for which
+// physical pages are allocated on first touch and it can be queried which ones were touched.
+class MemoryArena {
+public:
+
+    static const size_t cacheLineSize = 64;
+    static const size_t hugePageSize = 2 * 1024 * 1024;
+
+    MemoryArena(size_t blockSize = 64 * 1024);
+    ~MemoryArena();
+
+    // Affects only blocks allocated afterwards
+    void setUseHugePages(bool useHugePages);
+
+    // Allocate memory for the calling thread, the result is cache-line-aligned
+    // and its size is rounded up to a whole number of cache lines
+    void* allocate(size_t sizeBytes);
+
+    // Give back a piece from allocate() of the given size. Only the last piece of a block is reused,
+    // other pieces are kept until destruction. Must not run concurrently with allocate()
+    void release(void* data, size_t sizeBytes);
+
+    // Allocate a dedicated block of zero-initialized page-aligned memory for the calling thread.
+    // Where supported its pages are physically allocated on first touch, otherwise all at once
+    void* allocatePages(size_t sizeBytes);
+
+    // Size of memory pages, granularity of allocatePages()
+    static size_t getPageSize();
+
+    // For each page of the given memory from allocatePages() get whether it was touched.
+    // In case it can not be determined all pages are reported as touched
+    static void getTouchedPages(const void* data, size_t sizeBytes, std::vector<bool>& isTouched);
+
+    // Set the given memory from allocatePages() to zero and release its physical pages where supported
+    static void releasePages(void* data, size_t sizeBytes);
+
+    // Whether the pointer points to memory of the arena
+    bool contains(const void* ptr) const;
+
+    // Total size of all blocks and of the allocated pieces
+    size_t getReservedBytes() const;
+    size_t getAllocatedBytes() const;
+
+private:
+
+    struct Block {
+        char* data;
+        size_t size;
+        size_t used;
+        bool isMapped; // allocated with mmap
+    };
+
+    std::vector<std::vector<Block> > threadBlocks; // blocks of each thread, the last one is current
+    size_t blockSize;
+    bool useHugePages;
+
+    Block allocateBlock(size_t size);
+    std::vector<Block>& getThreadBlocks();
+    void freeBlock(Block& block);
+
+    // Copy and assignment are forbidden
+    MemoryArena(const MemoryArena&);
+    MemoryArena& operator=(const MemoryArena&);
+
+};
+
+
+} // namespace picmdk
+
+
+#endif
@@ -4,8 +4,10 @@
 
 #include "Controller.h"
 #include "Handler.h"
+#include "OpenMPWrapper.h"
 
 #include <string>
+#include <vector>
 
 
 namespace picmdk {
@@ -85,25 +87,25 @@ private:
     template<class HandlerClass>
     void addHandler(Controller& controller, OutputHandler<Controller>* handler)
     {
-        controller.addOutputHandler<HandlerClass>();
+        controller.template addOutputHandler<HandlerClass>();
     }
 
     template<class HandlerClass>
     void addHandler(Controller& controller, DomainHandler<Controller>* handler)
     {
-        controller.addDomainHandler<HandlerClass>();
+        controller.template addDomainHandler<HandlerClass>();
     }
 
     template<class HandlerClass>
     void addHandler(Controller& controller, CellHandler<Controller>* handler)
     {
-        controller.addCellHandler<HandlerClass>();
+        controller.template addCellHandler<HandlerClass>();
     }
 
     template<class HandlerClass>
     void addHandler(Controller& controller, ParticleHandler<Controller>* handler)
     {
-        controller.addParticleHandler<HandlerClass>();
+        controller.template addParticleHandler<HandlerClass>();
     }
 
     template<class HandlerClass>
@@ -115,6 +117,203 @@ private:
 
 };
 
+
+namespace internal {
+
+// Per-thread copies of a handler of a static module.
+// Only particle and cell handlers are stored here, other handlers are added to the controller as usual.
+// Handlers are called with qualified names, so the calls are not virtual and can be inlined.
+// Activity of the handler is cached by the controller once per iteration, inactive handlers are skipped.
+template<class Controller, class HandlerClass>
+class StaticHandlers {
+public:
+
+    typedef typename Controller::Cell Cell;
+    typedef typename Controller::Particle Particle;
+    typedef typename Controller::Real3 Real3;
+
+    StaticHandlers():
+        isActive(false)
+    {
+    }
+
+    void add(Controller& controller)
+    {
+        HandlerClass* handler = 0; // just for overloading to detect type
+        add(controller, handler);
+    }
+
+    void runParticleHandler(int threadIdx, Particle& particle, const Real3& E, const Real3& B)
+    {
+        HandlerClass* handler = 0;
+        runParticleHandler(handler, threadIdx, particle, E, B);
+    }
+
+    void runCellHandler(int threadIdx, Cell& cell)
+    {
+        HandlerClass* handler = 0;
+        runCellHandler(handler, threadIdx, cell);
+    }
+
+private:
+
+    void add(Controller& controller, OutputHandler<Controller>* /*handler*/)
+    {
+        controller.template addOutputHandler<HandlerClass>();
+    }
+
+    void add(Controller& controller, DomainHandler<Controller>* /*handler*/)
+    {
+        controller.template addDomainHandler<HandlerClass>();
+    }
+
+    void add(Controller& controller, CellHandler<Controller>* /*handler*/)
+    {
+        threadHandlers = controller.template createStaticHandlers<HandlerClass>(&isActive);
+    }
+
+    void add(Controller& controller, ParticleHandler<Controller>* /*handler*/)
+    {
+        threadHandlers = controller.template createStaticHandlers<HandlerClass>(&isActive);
+    }
+
+    void add(Controller& /*controller*/, DummyHandler<Controller>* /*handler*/)
+    {
+    }
+
+    void runParticleHandler(ParticleHandler<Controller>* /*handler*/, int threadIdx,
+        Particle& particle, const Real3& E, const Real3& B)
+    {
+        if (isActive)
+            threadHandlers[threadIdx]->HandlerClass::handle(particle, E, B);
+    }
+
+    void runParticleHandler(Handler* /*handler*/, int /*threadIdx*/,
+        Particle& /*particle*/, const Real3& /*E*/, const Real3& /*B*/)
+    {
+    }
+
+    void runCellHandler(CellHandler<Controller>* /*handler*/, int threadIdx, Cell& cell)
+    {
+        if (isActive)
+            threadHandlers[threadIdx]->HandlerClass::handle(cell);
+    }
+
+    void runCellHandler(Handler* /*handler*/, int /*threadIdx*/, Cell& /*cell*/)
+    {
+    }
+
+    std::vector<HandlerClass*> threadHandlers;
+    bool isActive; // whether the handler is active on the current iteration
+
+};
+
+} // namespace picmdk::internal
+
+
+// A module with the handlers given as template parameters, same as ModuleImplementation.
+// Particle and cell handlers are not run by the controller, instead the particle and cell loops
+// of the code call runParticleHandlers() and runCellHandlers() of the module directly.
+// The handlers are then called without virtual dispatch in a fused loop body,
+// so their code can be fully inlined into the loops.
+// Parameters equal to DummyHandler have no effect
+template<class Controller, class HandlerClass1,
+    class HandlerClass2 = DummyHandler<Controller>,
+    class HandlerClass3 = DummyHandler<Controller>,
+    class HandlerClass4 = DummyHandler<Controller>,
+    class HandlerClass5 = DummyHandler<Controller>,
+    class HandlerClass6 = DummyHandler<Controller>,
+    class HandlerClass7 = DummyHandler<Controller>,
+    class HandlerClass8 = DummyHandler<Controller>,
+    class HandlerClass9 = DummyHandler<Controller>,
+    class HandlerClass10 = DummyHandler<Controller> >
+class StaticModuleImplementation: public Module<Controller> {
+public:
+
+    typedef typename Controller::Cell Cell;
+    typedef typename Controller::Particle Particle;
+    typedef typename Controller::Real3 Real3;
+
+    virtual void setInstanceName(const std::string& name)
+    {
+        instanceName = name;
+    }
+
+    virtual std::string getInstanceName() const
+    {
+        return instanceName;
+    }
+
+    virtual void addHandlers(Controller& controller)
+    {
+        handlers1.add(controller);
+        handlers2.add(controller);
+        handlers3.add(controller);
+        handlers4.add(controller);
+        handlers5.add(controller);
+        handlers6.add(controller);
+        handlers7.add(controller);
+        handlers8.add(controller);
+        handlers9.add(controller);
+        handlers10.add(controller);
+    }
+
+    // Run particle handlers of the module active on the current iteration in order of template parameters
+    void runParticleHandlers(Particle& particle, const Real3& E, const Real3& B)
+    {
+        int threadIdx = omp_get_thread_num();
+        handlers1.runParticleHandler(threadIdx, particle, E, B);
+        handlers2.runParticleHandler(threadIdx, particle, E, B);
+        handlers3.runParticleHandler(threadIdx, particle, E, B);
+        handlers4.runParticleHandler(threadIdx, particle, E, B);
+        handlers5.runParticleHandler(threadIdx, particle, E, B);
+        handlers6.runParticleHandler(threadIdx, particle, E, B);
+        handlers7.runParticleHandler(threadIdx, particle, E, B);
+        handlers8.runParticleHandler(threadIdx, particle, E, B);
+        handlers9.runParticleHandler(threadIdx, particle, E, B);
+        handlers10.runParticleHandler(threadIdx, particle, E, B);
+    }
+
+    // Run particle handlers for a chunk of particles, all handlers process a particle before the next one
+    void runParticleHandlers(Particle* particles, const Real3* E, const Real3* B, int numParticles)
+    {
+        for (int i = 0; i < numParticles; i++)
+            runParticleHandlers(particles[i], E[i], B[i]);
+    }
+
+    // Run cell handlers of the module active on the current iteration in order of template parameters
+    void runCellHandlers(Cell& cell)
+    {
+        int threadIdx = omp_get_thread_num();
+        handlers1.runCellHandler(threadIdx, cell);
+        handlers2.runCellHandler(threadIdx, cell);
+        handlers3.runCellHandler(threadIdx, cell);
+        handlers4.runCellHandler(threadIdx, cell);
+        handlers5.runCellHandler(threadIdx, cell);
+        handlers6.runCellHandler(threadIdx, cell);
+        handlers7.runCellHandler(threadIdx, cell);
+        handlers8.runCellHandler(threadIdx, cell);
+        handlers9.runCellHandler(threadIdx, cell);
+        handlers10.runCellHandler(threadIdx, cell);
+    }
+
+private:
+
+    internal::StaticHandlers<Controller, HandlerClass1> handlers1;
+    internal::StaticHandlers<Controller, HandlerClass2> handlers2;
+    internal::StaticHandlers<Controller, HandlerClass3> handlers3;
+    internal::StaticHandlers<Controller, HandlerClass4> handlers4;
+    internal::StaticHandlers<Controller, HandlerClass5> handlers5;
+    internal::StaticHandlers<Controller, HandlerClass6> handlers6;
+    internal::StaticHandlers<Controller, HandlerClass7> handlers7;
+    internal::StaticHandlers<Controller, HandlerClass8> handlers8;
+    internal::StaticHandlers<Controller, HandlerClass9> handlers9;
+    internal::StaticHandlers<Controller, HandlerClass10> handlers10;
+
+    std::string instanceName;
+
+};
+
 } // namespace picmdk
 
 #endif
\ No newline at end of file
@@ -0,0 +1,72 @@
+#ifndef PICMDK_REDUCTIONKERNELS_H
+#define PICMDK_REDUCTIONKERNELS_H
+
+
+namespace picmdk {
+
+// Element-wise reduction kernels used by InterData synchronizers:
+// dst[i] = op(dst[i], src[i]) for i in [0, n).
+// Versions for float, double and int are vectorized, the instruction set
+// is chosen at runtime as the best one supported by the CPU.
+// Other types use the generic scalar versions.
+namespace kernels {
+
+
+enum InstructionSet { Scalar, SSE2, AVX2, AVX512 };
+
+// Instruction set currently used by the kernels
+InstructionSet getInstructionSet();
+// Use the given instruction set if supported by the CPU, otherwise the best supported one
+void setInstructionSet(InstructionSet instructionSet);
+const char* getInstructionSetName(InstructionSet instructionSet);
+
+
+template<typename T>
+inline void sum(T* dst, const T* src, int n)
+{
+    for (int i = 0; i < n; i++)
+        dst[i] += src[i];
+}
+
+template<typename T>
+inline void product(T* dst, const T* src, int n)
+{
+    for (int i = 0; i < n; i++)
+        dst[i] *= src[i];
+}
+
+template<typename T>
+inline void max(T* dst, const T* src, int n)
+{
+    for (int i = 0; i < n; i++)
+        if (dst[i] < src[i])
+            dst[i] = src[i];
+}
+
+template<typename T>
+inline void min(T* dst, const T* src, int n)
+{
+    for (int i = 0; i < n; i++)
+        if (src[i] < dst[i])
+            dst[i] = src[i];
+}
+
+void sum(float* dst, const float* src, int n);
+void sum(double* dst, const double* src, int n);
+void sum(int* dst, const int* src, int n);
+void product(float* dst, const float* src, int n);
+void product(double* dst, const double* src, int n);
+void product(int* dst, const int* src, int n);
+void max(float* dst, const float* src, int n);
+void max(double* dst, const double* src, int n);
+void max(int* dst, const int* src, int n);
+void min(float* dst, const float* src, int n);
+void min(double* dst, const double* src, int n);
+void min(int* dst, const int* src, int n);
+
+
+} // namespace picmdk::kernels
+} // namespace picmdk
+
+
+#endif
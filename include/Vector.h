@@ -54,7 +54,7 @@ inline Vector2<T>& operator += (Vector2<T>& v1, const Vector2<T>& v2)
 template<typename T>
 inline const Vector2<T> operator - (const Vector2<T>& v1, const Vector2<T>& v2)
 {
-    return Vector3<T>(v1.x - v2.x, v1.y - v2.y);
+    return Vector2<T>(v1.x - v2.x, v1.y - v2.y);
 }
 
 template<typename T>
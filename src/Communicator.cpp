@@ -12,6 +12,11 @@ class CommunicatorImplementation: public Communicator {
 public:
 
     CommunicatorImplementation(MPI_Comm communicator);
+    virtual ~CommunicatorImplementation();
+
+    // Implementation of static methods of Communicator
+    static MPI_Op createOp(MPI_User_function* function, bool isCommutative);
+    static MPI_Datatype createContiguousDatatype(int sizeBytes);
 
     // Getters
     virtual int getRank() const;
@@ -32,10 +37,42 @@ public:
     virtual void bcast(void *buffer, int count, MPI_Datatype datatype, int root);
     virtual void gather(void *sendbuf, int sendcount, MPI_Datatype sendtype,
         void *recvbuf, int recvcount, MPI_Datatype recvtype, int root);
+    virtual void gatherv(void *sendbuf, int sendcount, MPI_Datatype sendtype,
+        void *recvbuf, int *recvcounts, int *displs, MPI_Datatype recvtype, int root);
+    virtual void allgather(void *sendbuf, int sendcount, MPI_Datatype sendtype,
+        void *recvbuf, int recvcount, MPI_Datatype recvtype);
+    virtual void allgatherv(void *sendbuf, int sendcount, MPI_Datatype sendtype,
+        void *recvbuf, int *recvcounts, int *displs, MPI_Datatype recvtype);
     virtual void reduce(void *sendbuf, void *recvbuf, int count,
         MPI_Datatype datatype, MPI_Op op, int root);
     virtual void allreduce(void *sendbuf, void *recvbuf, int count,
         MPI_Datatype datatype, MPI_Op op);
+    virtual void reduceScatter(void *sendbuf, void *recvbuf, int *recvcounts,
+        MPI_Datatype datatype, MPI_Op op);
+
+    // Non-blocking communication operations, completed by wait() or test()
+    virtual void iallreduce(void *sendbuf, void *recvbuf, int count,
+        MPI_Datatype datatype, MPI_Op op, MPI_Request *request);
+    virtual void ireduce(void *sendbuf, void *recvbuf, int count,
+        MPI_Datatype datatype, MPI_Op op, int root, MPI_Request *request);
+    virtual void ireduceScatter(void *sendbuf, void *recvbuf, int *recvcounts,
+        MPI_Datatype datatype, MPI_Op op, MPI_Request *request);
+    virtual void igatherv(void *sendbuf, int sendcount, MPI_Datatype sendtype,
+        void *recvbuf, int *recvcounts, int *displs, MPI_Datatype recvtype, int root,
+        MPI_Request *request);
+    virtual void iallgatherv(void *sendbuf, int sendcount, MPI_Datatype sendtype,
+        void *recvbuf, int *recvcounts, int *displs, MPI_Datatype recvtype,
+        MPI_Request *request);
+    virtual void wait(MPI_Request *request, MPI_Status *status);
+    virtual bool test(MPI_Request *request, MPI_Status *status);
+
+    // Communicators of subsets of processes and shared memory windows
+    virtual ::std::auto_ptr<Communicator> splitShared();
+    virtual ::std::auto_ptr<Communicator> split(int color, int key);
+    virtual void* allocateSharedWindow(long long sizeBytes, MPI_Win* window);
+    virtual void* getSharedWindowSegment(MPI_Win window, int rank);
+    virtual void synchronizeSharedWindow(MPI_Win window);
+    virtual void freeSharedWindow(MPI_Win* window);
 
 protected:
 
@@ -66,6 +103,12 @@ CommunicatorImplementation::CommunicatorImplementation(MPI_Comm _communicator)
     PICMDK_MPI_CHECK(MPI_Comm_rank(communicator, &rank));
 }
 
+// The duplicated communicator is freed without checking, as destructors do not throw
+CommunicatorImplementation::~CommunicatorImplementation()
+{
+    MPI_Comm_free(&communicator);
+}
+
 int CommunicatorImplementation::getRank() const
 {
     return rank;
@@ -119,6 +162,27 @@ void CommunicatorImplementation::gather(void *sendbuf, int sendcount,
         recvtype, root, communicator));
 }
 
+void CommunicatorImplementation::gatherv(void *sendbuf, int sendcount, MPI_Datatype sendtype,
+    void *recvbuf, int *recvcounts, int *displs, MPI_Datatype recvtype, int root)
+{
+    PICMDK_MPI_CHECK(MPI_Gatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts,
+        displs, recvtype, root, communicator));
+}
+
+void CommunicatorImplementation::allgather(void *sendbuf, int sendcount,
+    MPI_Datatype sendtype, void *recvbuf, int recvcount, MPI_Datatype recvtype)
+{
+    PICMDK_MPI_CHECK(MPI_Allgather(sendbuf, sendcount, sendtype, recvbuf, recvcount,
+        recvtype, communicator));
+}
+
+void CommunicatorImplementation::allgatherv(void *sendbuf, int sendcount, MPI_Datatype sendtype,
+    void *recvbuf, int *recvcounts, int *displs, MPI_Datatype recvtype)
+{
+    PICMDK_MPI_CHECK(MPI_Allgatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts,
+        displs, recvtype, communicator));
+}
+
 void CommunicatorImplementation::reduce(void *sendbuf, void *recvbuf,
     int count, MPI_Datatype datatype, MPI_Op op, int root)
 {
@@ -132,6 +196,126 @@ void CommunicatorImplementation::allreduce(void *sendbuf, void *recvbuf,
     PICMDK_MPI_CHECK(MPI_Allreduce(sendbuf, recvbuf, count, datatype, op, communicator));
 }
 
+void CommunicatorImplementation::reduceScatter(void *sendbuf, void *recvbuf, int *recvcounts,
+    MPI_Datatype datatype, MPI_Op op)
+{
+    PICMDK_MPI_CHECK(MPI_Reduce_scatter(sendbuf, recvbuf, recvcounts, datatype, op, communicator));
+}
+
+void CommunicatorImplementation::iallreduce(void *sendbuf, void *recvbuf,
+    int count, MPI_Datatype datatype, MPI_Op op, MPI_Request *request)
+{
+    PICMDK_MPI_CHECK(MPI_Iallreduce(sendbuf, recvbuf, count, datatype, op, communicator, request));
+}
+
+void CommunicatorImplementation::ireduce(void *sendbuf, void *recvbuf, int count,
+    MPI_Datatype datatype, MPI_Op op, int root, MPI_Request *request)
+{
+    PICMDK_MPI_CHECK(MPI_Ireduce(sendbuf, recvbuf, count, datatype, op, root, communicator, request));
+}
+
+void CommunicatorImplementation::ireduceScatter(void *sendbuf, void *recvbuf, int *recvcounts,
+    MPI_Datatype datatype, MPI_Op op, MPI_Request *request)
+{
+    PICMDK_MPI_CHECK(MPI_Ireduce_scatter(sendbuf, recvbuf, recvcounts, datatype, op, communicator, request));
+}
+
+void CommunicatorImplementation::igatherv(void *sendbuf, int sendcount, MPI_Datatype sendtype,
+    void *recvbuf, int *recvcounts, int *displs, MPI_Datatype recvtype, int root,
+    MPI_Request *request)
+{
+    PICMDK_MPI_CHECK(MPI_Igatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts,
+        displs, recvtype, root, communicator, request));
+}
+
+void CommunicatorImplementation::iallgatherv(void *sendbuf, int sendcount, MPI_Datatype sendtype,
+    void *recvbuf, int *recvcounts, int *displs, MPI_Datatype recvtype,
+    MPI_Request *request)
+{
+    PICMDK_MPI_CHECK(MPI_Iallgatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts,
+        displs, recvtype, communicator, request));
+}
+
+void CommunicatorImplementation::wait(MPI_Request *request, MPI_Status *status)
+{
+    PICMDK_MPI_CHECK(MPI_Wait(request, status));
+}
+
+bool CommunicatorImplementation::test(MPI_Request *request, MPI_Status *status)
+{
+    int flag = 0;
+    PICMDK_MPI_CHECK(MPI_Test(request, &flag, status));
+    return flag != 0;
+}
+
+// The created communicator is duplicated by the constructor, so the temporary one is freed
+::std::auto_ptr<Communicator> CommunicatorImplementation::splitShared()
+{
+    MPI_Comm newCommunicator;
+    PICMDK_MPI_CHECK(MPI_Comm_split_type(communicator, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &newCommunicator));
+    ::std::auto_ptr<Communicator> result(new CommunicatorImplementation(newCommunicator));
+    PICMDK_MPI_CHECK(MPI_Comm_free(&newCommunicator));
+    return result;
+}
+
+::std::auto_ptr<Communicator> CommunicatorImplementation::split(int color, int key)
+{
+    MPI_Comm newCommunicator;
+    PICMDK_MPI_CHECK(MPI_Comm_split(communicator, color, key, &newCommunicator));
+    if (newCommunicator == MPI_COMM_NULL)
+        return ::std::auto_ptr<Communicator>();
+    ::std::auto_ptr<Communicator> result(new CommunicatorImplementation(newCommunicator));
+    PICMDK_MPI_CHECK(MPI_Comm_free(&newCommunicator));
+    return result;
+}
+
+// The window is locked for all processes for its whole lifetime, so that
+// the segments are accessed by loads and stores ordered by synchronizeSharedWindow()
+void* CommunicatorImplementation::allocateSharedWindow(long long sizeBytes, MPI_Win* window)
+{
+    void* segment = 0;
+    PICMDK_MPI_CHECK(MPI_Win_allocate_shared((MPI_Aint)sizeBytes, 1, MPI_INFO_NULL, communicator, &segment, window));
+    PICMDK_MPI_CHECK(MPI_Win_lock_all(MPI_MODE_NOCHECK, *window));
+    return segment;
+}
+
+void* CommunicatorImplementation::getSharedWindowSegment(MPI_Win window, int segmentRank)
+{
+    MPI_Aint sizeBytes = 0;
+    int displacementUnit = 0;
+    void* segment = 0;
+    PICMDK_MPI_CHECK(MPI_Win_shared_query(window, segmentRank, &sizeBytes, &displacementUnit, &segment));
+    return segment;
+}
+
+void CommunicatorImplementation::synchronizeSharedWindow(MPI_Win window)
+{
+    PICMDK_MPI_CHECK(MPI_Win_sync(window));
+    PICMDK_MPI_CHECK(MPI_Barrier(communicator));
+    PICMDK_MPI_CHECK(MPI_Win_sync(window));
+}
+
+void CommunicatorImplementation::freeSharedWindow(MPI_Win* window)
+{
+    PICMDK_MPI_CHECK(MPI_Win_unlock_all(*window));
+    PICMDK_MPI_CHECK(MPI_Win_free(window));
+}
+
+MPI_Op CommunicatorImplementation::createOp(MPI_User_function* function, bool isCommutative)
+{
+    MPI_Op op;
+    PICMDK_MPI_CHECK(MPI_Op_create(function, isCommutative ? 1 : 0, &op));
+    return op;
+}
+
+MPI_Datatype CommunicatorImplementation::createContiguousDatatype(int sizeBytes)
+{
+    MPI_Datatype datatype;
+    PICMDK_MPI_CHECK(MPI_Type_contiguous(sizeBytes, MPI_BYTE, &datatype));
+    PICMDK_MPI_CHECK(MPI_Type_commit(&datatype));
+    return datatype;
+}
+
 
 #undef PICMDK_MPI_CHECK
 
@@ -152,5 +336,25 @@ Communicator::~Communicator()
 {
 }
 
+MPI_Op Communicator::createOp(MPI_User_function* function, bool isCommutative)
+{
+    return CommunicatorImplementation::createOp(function, isCommutative);
+}
+
+MPI_Datatype Communicator::createContiguousDatatype(int sizeBytes)
+{
+    return CommunicatorImplementation::createContiguousDatatype(sizeBytes);
+}
+
+void Communicator::freeOp(MPI_Op* op)
+{
+    MPI_Op_free(op);
+}
+
+void Communicator::freeDatatype(MPI_Datatype* datatype)
+{
+    MPI_Type_free(datatype);
+}
+
 
 } // namespace MDK
@@ -93,4 +93,14 @@ NotImplementedException::~NotImplementedException() throw()
 }
 
 
+FileException::FileException(const std::string& message):
+    NamedException(message, "file exception")
+{
+}
+
+FileException::~FileException() throw()
+{
+}
+
+
 } // namespace picmdk
@@ -1,6 +1,9 @@
 #include "InterData.h"
 
 #include "Handler.h"
+#include "OpenMPWrapper.h"
+
+#include <climits>
 
 namespace {
 
@@ -8,6 +11,31 @@ namespace {
 using namespace picmdk;
 
 
+bool isGather(InterData::SynchronizationMode::Operation operation)
+{
+    return (operation == InterData::SynchronizationMode::Gather) ||
+        (operation == InterData::SynchronizationMode::AllGather);
+}
+
+
+// Chunks are small enough for the chunk of the result to stay in L1 cache
+// while chunks of all copies are reduced into it
+const int reductionChunkSizeBytes = 16 * 1024;
+// Below this total size of reduced copies the thread-level stage is done serially
+const int minParallelReductionSizeBytes = 256 * 1024;
+
+// Tag of messages of halo exchange
+const int haloExchangeTag = 0;
+
+// MPI counts are int, so larger collectives of buckets are split into parts
+const long long maxCollectiveCount = INT_MAX;
+
+
+// Whether handlers of the given type have a copy for each thread
+bool isMultithreaded(const Handler* handler)
+{
+    return (handler->getType() == Handler::Particle) || (handler->getType() == Handler::Cell);
+}
 
 
 } // anonymous namespace
@@ -17,20 +45,86 @@ using namespace picmdk;
 namespace picmdk {
 
 
+InterData::InterData():
+    reductionSizeBytes(0),
+    currentHandler(0),
+    communicator(0),
+    isAsynchronous(false),
+    isDirtyTracking(false),
+    isNodeReduction(false),
+    isDoubleBuffering(false)
+{
+}
+
+// Collective on the node communicators if node-level reduction was used,
+// so it must be destroyed on all processes before MPI_Finalize
+InterData::~InterData()
+{
+    freeNodeReduction();
+    leaderCommunicator.reset();
+    nodeCommunicator.reset();
+    for (std::map<MPI_User_function*, MPI_Op>::iterator op = customOps.begin(); op != customOps.end(); ++op)
+        Communicator::freeOp(&op->second);
+    for (std::map<int, MPI_Datatype>::iterator datatype = customDatatypes.begin(); datatype != customDatatypes.end(); ++datatype)
+        Communicator::freeDatatype(&datatype->second);
+    for (size_t i = 0; i < exportData.size(); i++) {
+        delete exportData[i].synchronizer;
+        delete exportData[i].finalizer;
+    }
+}
+
 void InterData::registerExport(DataSetBase* dataSet, const std::string& name, SynchronizationMode mode,
     SynchronizerBase* synchronizer, FinalizerBase* finalizer)
 {
     ExportDescription exportDescription;
     exportDescription.dataSet = dataSet;
     exportDescription.name = name;
-    exportDescription.isGlobal = (mode.locality == SynchronizationMode::Global);
+    exportDescription.handler = currentHandler;
+    exportDescription.isGlobal = (mode.locality != SynchronizationMode::Local);
+    exportDescription.locality = mode.locality;
+    exportDescription.root = mode.root;
+    exportDescription.operation = mode.operation;
+    if (((mode.locality == SynchronizationMode::Root) || (mode.locality == SynchronizationMode::ReduceScatter)) &&
+        isGather(mode.operation))
+        PICMDK_THROW(SynchronizationException, ("dataset '" + name + "' has a gather operation with Root or ReduceScatter locality"));
+    if ((mode.locality == SynchronizationMode::Halo) && (mode.operation != SynchronizationMode::None) &&
+        (mode.operation != SynchronizationMode::Sum) && (mode.operation != SynchronizationMode::Copy))
+        PICMDK_THROW(SynchronizationException, ("dataset '" + name + "' with Halo locality supports only Sum and Copy synchronization"));
+    if ((mode.operation == SynchronizationMode::Copy) && (mode.locality != SynchronizationMode::Halo))
+        PICMDK_THROW(SynchronizationException, ("dataset '" + name + "' supports Copy synchronization only with Halo locality"));
+    exportDescription.isShared = (mode.sharing == SynchronizationMode::Shared);
+    if (exportDescription.isShared && (mode.operation != SynchronizationMode::Sum))
+        PICMDK_THROW(SynchronizationException, ("shared dataset '" + name + "' supports only Sum synchronization"));
+    exportDescription.isLazy = (mode.sharing == SynchronizationMode::LazyPrivate);
+    if (exportDescription.isLazy && (mode.operation != SynchronizationMode::Sum) && (mode.operation != SynchronizationMode::Average))
+        PICMDK_THROW(SynchronizationException, ("lazily allocated dataset '" + name + "' supports only Sum and Average synchronization"));
+    exportDescription.isCleared = (mode.finalization == SynchronizationMode::Clear);
+    exportDescription.schedule = mode.schedule;
+    if (mode.schedule.period < 1)
+        PICMDK_THROW(SynchronizationException, ("dataset '" + name + "' has non-positive synchronization period"));
+    if ((mode.schedule.event != Event::numEvents) && (mode.schedule.event != Event::IterationStart) &&
+        (mode.schedule.event != Event::Output))
+        PICMDK_THROW(SynchronizationException, ("dataset '" + name + "' is bound to an event not supported for synchronization"));
+    exportDescription.synchronizationIdx = -1;
     exportDescription.synchronizer = synchronizer;
     exportDescription.finalizer = finalizer;
     exportDescription.destination = 0;
-    exportDescription.threadIdx = 0;
-    bool isMultithreaded = (currentHandler->getType() == Handler::Particle || currentHandler->getType() == Handler::Cell);
-    if (!exportData.empty() && exportData.back().name == exportDescription.name)
-        exportDescription.threadIdx = exportData.back().threadIdx + 1;
+    // Copies of multithreaded handlers are registered for threads in order,
+    // possibly interleaved with other datasets
+    std::vector<int>& copies = exportIdxByName[name];
+    exportDescription.threadIdx = isMultithreaded(currentHandler) ? (int)copies.size() : 0;
+    copies.push_back((int)exportData.size());
+    exportData.push_back(exportDescription);
+}
+
+int InterData::findSharedOwner(const std::string& name, SynchronizationMode mode) const
+{
+    if ((mode.sharing != SynchronizationMode::Shared) || !isMultithreaded(currentHandler))
+        return -1;
+    std::map<std::string, std::vector<int> >::const_iterator copies = exportIdxByName.find(name);
+    if ((copies == exportIdxByName.end()) || !exportData[copies->second[0]].isShared)
+        return -1;
+    return copies->second[0];
 }
 
 void InterData::registerImport(DataSetBase* dataSet, const std::string& name)
@@ -38,6 +132,8 @@ void InterData::registerImport(DataSetBase* dataSet, const std::string& name)
     ImportDescrtiption importDescription;
     importDescription.dataSet = dataSet;
     importDescription.name = name;
+    importDescription.handler = currentHandler;
+    importDescription.synchronizationIdx = -1;
     importData.push_back(importDescription);
 }
 
@@ -47,16 +143,1005 @@ void InterData::setCurrentHandler(Handler* handler)
     currentHandler = handler;
 }
 
+// Data of removed copies stays in the arena, copies of each remaining dataset are renumbered by threads
+void InterData::unregisterHandlers(const std::set<const Handler*>& handlers)
+{
+    std::set<const DataSetBase*> removedDataSets;
+    std::vector<ExportDescription> remainingExports;
+    for (size_t i = 0; i < exportData.size(); i++) {
+        if (handlers.count(exportData[i].handler)) {
+            removedDataSets.insert(exportData[i].dataSet);
+            delete exportData[i].synchronizer;
+            delete exportData[i].finalizer;
+        }
+        else
+            remainingExports.push_back(exportData[i]);
+    }
+    exportData.swap(remainingExports);
+    exportIdxByName.clear();
+    for (size_t i = 0; i < exportData.size(); i++) {
+        ExportDescription& exportDescription = exportData[i];
+        std::vector<DataSetBase*>& sharedCopies = exportDescription.sharedCopies;
+        for (size_t k = 0; k < sharedCopies.size(); )
+            if (removedDataSets.count(sharedCopies[k]))
+                sharedCopies.erase(sharedCopies.begin() + k);
+            else
+                k++;
+        std::vector<int>& copies = exportIdxByName[exportDescription.name];
+        exportDescription.threadIdx = isMultithreaded(exportDescription.handler) ? (int)copies.size() : 0;
+        copies.push_back((int)i);
+    }
+
+    std::vector<ImportDescrtiption> remainingImports;
+    for (size_t i = 0; i < importData.size(); i++)
+        if (!handlers.count(importData[i].handler))
+            remainingImports.push_back(importData[i]);
+    importData.swap(remainingImports);
+}
+
+void InterData::setCommunicator(Communicator* _communicator)
+{
+    communicator = _communicator;
+}
+
+void InterData::setAsynchronous(bool asynchronous)
+{
+    isAsynchronous = asynchronous;
+}
+
+void InterData::setDirtyTracking(bool dirtyTracking)
+{
+    isDirtyTracking = dirtyTracking;
+}
+
+void InterData::setNodeReduction(bool nodeReduction)
+{
+    isNodeReduction = nodeReduction;
+}
+
+void InterData::setDoubleBuffering(bool doubleBuffering)
+{
+    isDoubleBuffering = doubleBuffering;
+}
+
+void InterData::setDomainDecomposition(const Vector3<int>& numDomains, const Vector3<int>& isPeriodic)
+{
+    if (!communicator || (numDomains.volume() != communicator->getNumProcesses()))
+        PICMDK_THROW(SynchronizationException, ("domain decomposition " + toString(numDomains) + " does not match the number of processes"));
+    int rank = communicator->getRank();
+    Vector3<int> domainIdx(rank / (numDomains.y * numDomains.z), (rank / numDomains.z) % numDomains.y, rank % numDomains.z);
+    neighbourRanks.resize(6);
+    for (int d = 0; d < 3; d++)
+        for (int shift = -1; shift <= 1; shift += 2) {
+            Vector3<int> neighbourIdx = domainIdx;
+            neighbourIdx[d] += shift;
+            if (isPeriodic[d])
+                neighbourIdx[d] = (neighbourIdx[d] + numDomains[d]) % numDomains[d];
+            bool isInside = (neighbourIdx[d] >= 0) && (neighbourIdx[d] < numDomains[d]);
+            neighbourRanks[2 * d + (shift + 1) / 2] = isInside ?
+                (neighbourIdx.x * numDomains.y + neighbourIdx.y) * numDomains.z + neighbourIdx.z : MPI_PROC_NULL;
+        }
+}
+
+void InterData::setUseHugePages(bool useHugePages)
+{
+    arena.setUseHugePages(useHugePages);
+}
+
+// Datasets can be out of the arena in case they were resized after registration
+void InterData::writeMemoryUsage(std::ostream& stream) const
+{
+    stream << "InterData memory usage:\n";
+    for (size_t i = 0; i < exportData.size(); i++) {
+        DataSetBase* dataSet = exportData[i].dataSet;
+        stream << "   export '" << exportData[i].name << "', thread " << exportData[i].threadIdx << ": " <<
+            dataSet->getRawSizeBytes() << " byte(s)" << (exportData[i].isShared ? ", shared by threads" : "") <<
+            (exportData[i].isLazy ? ", lazily allocated" : "") <<
+            ((dataSet->getRawSizeBytes() && !dataSet->isInArena(arena)) ? ", not in arena" : "") << "\n";
+    }
+    for (size_t i = 0; i < importData.size(); i++) {
+        DataSetBase* dataSet = importData[i].dataSet;
+        stream << "   import '" << importData[i].name << "': " << dataSet->getRawSizeBytes() << " byte(s)" <<
+            ((dataSet->getRawSizeBytes() && !dataSet->isInArena(arena)) ? ", not in arena" : "") << "\n";
+    }
+    stream << "   arena: " << arena.getAllocatedBytes() << " byte(s) allocated of " <<
+        arena.getReservedBytes() << " byte(s) reserved\n";
+}
+
+int InterData::findSynchronization(const std::string& name) const
+{
+    std::map<std::string, int>::const_iterator sync = synchronizationIdxByName.find(name);
+    return (sync == synchronizationIdxByName.end()) ? -1 : sync->second;
+}
+
+// Match all exports and imports by names, all exports with the same name are
+// reduced together and the result goes to all imports with this name.
+// The order of synchronizations is the order of first exports, so all processes
+// must register the global datasets in the same order.
 void InterData::finalizeInit()
 {
+    waitSynchronizationAll();
+    synchronizationData.clear();
+    synchronizationIdxByName.clear();
+    synchronizationIdxByHandler.clear();
+    for (int i = 0; i < (int)exportData.size(); i++) {
+        const ExportDescription& exportDescription = exportData[i];
+        if (findSynchronization(exportDescription.name) >= 0)
+            continue;
+        synchronizationIdxByName[exportDescription.name] = (int)synchronizationData.size();
+        synchronizationData.push_back(SynchronizationDescription());
+        SynchronizationDescription& sync = synchronizationData.back();
+        sync.name = exportDescription.name;
+        sync.operation = exportDescription.operation;
+        sync.isGlobal = exportDescription.isGlobal && (exportDescription.operation != SynchronizationMode::None);
+        sync.locality = sync.isGlobal ? exportDescription.locality : SynchronizationMode::Local;
+        sync.root = exportDescription.root;
+        sync.schedule = exportDescription.schedule;
+        sync.isActive = false;
+        sync.wasDirty = true;
+        sync.exportIdx = exportIdxByName[exportDescription.name];
+        sync.synchronizer = exportDescription.synchronizer;
+        for (size_t j = 1; j < sync.exportIdx.size(); j++) {
+            const ExportDescription& copy = exportData[sync.exportIdx[j]];
+            if ((copy.operation != exportDescription.operation) || (copy.locality != exportDescription.locality) ||
+                (copy.root != exportDescription.root) || !(copy.schedule == exportDescription.schedule))
+                PICMDK_THROW(SynchronizationException, ("dataset '" + sync.name + "' is exported with different synchronization modes"));
+            if (!isGather(sync.operation) && (copy.dataSet->getRawSizeBytes() != exportDescription.dataSet->getRawSizeBytes()))
+                PICMDK_THROW(SynchronizationException, ("dataset '" + sync.name + "' is exported with different sizes"));
+        }
+        for (size_t j = 0; j < sync.exportIdx.size(); j++)
+            exportData[sync.exportIdx[j]].synchronizationIdx = (int)synchronizationData.size() - 1;
+    }
+
+    for (int i = 0; i < (int)importData.size(); i++) {
+        int syncIdx = findSynchronization(importData[i].name);
+        if (syncIdx < 0)
+            PICMDK_THROW(SynchronizationException, ("dataset '" + importData[i].name + "' is imported, but never exported"));
+        SynchronizationDescription& sync = synchronizationData[syncIdx];
+        if (!isGather(sync.operation) && (importData[i].dataSet->getRawSizeBytes() != exportData[sync.exportIdx[0]].dataSet->getRawSizeBytes()))
+            PICMDK_THROW(SynchronizationException, ("dataset '" + sync.name + "' is imported with size different from export"));
+        sync.importIdx.push_back(i);
+        importData[i].synchronizationIdx = syncIdx;
+        std::vector<int>& handlerSyncs = synchronizationIdxByHandler[importData[i].handler];
+        if (std::find(handlerSyncs.begin(), handlerSyncs.end(), syncIdx) == handlerSyncs.end())
+            handlerSyncs.push_back(syncIdx);
+    }
+
+    createSynchronizationPlan();
+}
+
+void InterData::getReduceScatterSlab(const std::string& name, int& begin, int& end) const
+{
+    int syncIdx = findSynchronization(name);
+    if ((syncIdx < 0) || (synchronizationData[syncIdx].locality != SynchronizationMode::ReduceScatter))
+        PICMDK_THROW(SynchronizationException, ("dataset '" + name + "' is not synchronized with ReduceScatter locality"));
+    begin = synchronizationData[syncIdx].sliceBegin;
+    end = synchronizationData[syncIdx].sliceEnd;
+}
+
+// Global synchronizations with the same operation, datatype, schedule and receivers are packed into
+// a single buffer, bucket order is the order of synchronizations.
+// For ReduceScatter the slab of process p consists of slices [p * n / P, (p + 1) * n / P)
+// of the first index, where n is the number of slices and P is the number of processes.
+void InterData::createSynchronizationPlan()
+{
+    freeNodeReduction();
+    synchronizationBuckets.clear();
+    std::vector<int> numContributors;
+    for (int i = 0; i < (int)synchronizationData.size(); i++) {
+        SynchronizationDescription& sync = synchronizationData[i];
+        SynchronizerBase* synchronizer = exportData[sync.exportIdx[0]].synchronizer;
+        sync.sizeBytes = exportData[sync.exportIdx[0]].dataSet->getRawSizeBytes();
+        sync.numContributors = (int)sync.exportIdx.size();
+        sync.resultOffsetBytes = 0;
+        sync.resultSizeBytes = sync.sizeBytes;
+        sync.sliceBegin = 0;
+        sync.sliceEnd = 0;
+        sync.bucketIdx = -1;
+        sync.bucketOffsetBytes = 0;
+        sync.request = MPI_REQUEST_NULL;
+        sync.isPending = false;
+        if (sync.isGlobal && !communicator)
+            PICMDK_THROW(SynchronizationException, ("dataset '" + sync.name + "' requires global synchronization, but no communicator is set"));
+        if (sync.isGlobal && ((sync.root < 0) || (sync.root >= communicator->getNumProcesses())))
+            PICMDK_THROW(SynchronizationException, ("dataset '" + sync.name + "' has root " + toString(sync.root) + " out of range of processes"));
+        // Gathers have sizes known only at synchronization and are not packed
+        if (isGather(sync.operation))
+            continue;
+        for (size_t j = 0; j < sync.exportIdx.size(); j++)
+            sync.sources.push_back((char*)exportData[sync.exportIdx[j]].dataSet->getRaw());
+        for (size_t j = 0; j < sync.importIdx.size(); j++)
+            sync.destinations.push_back((char*)importData[sync.importIdx[j]].dataSet->getRaw());
+        if (!sync.isGlobal) {
+            sync.storage.resize(sync.sizeBytes);
+            continue;
+        }
+        numContributors.push_back(sync.numContributors);
+
+        // Halo exchange sends raw bytes, so any element type is supported
+        if (sync.locality == SynchronizationMode::Halo) {
+            sync.storage.resize(sync.sizeBytes);
+            if (!exportData[sync.exportIdx[0]].dataSet->getGhostLayout(sync.fullSize, sync.ghostWidth))
+                PICMDK_THROW(SynchronizationException, ("dataset '" + sync.name + "' has Halo locality, but no ghost layers"));
+            if (neighbourRanks.empty())
+                PICMDK_THROW(SynchronizationException, ("dataset '" + sync.name + "' requires halo exchange, but no domain decomposition is set"));
+            long long maxLayerNumElements = 0;
+            for (int d = 0; d < 3; d++) {
+                if (sync.fullSize[d] < 3 * sync.ghostWidth)
+                    PICMDK_THROW(SynchronizationException, ("dataset '" + sync.name + "' has less cells than the width of ghost layers"));
+                maxLayerNumElements = std::max(maxLayerNumElements,
+                    (long long)sync.ghostWidth * sync.fullSize[(d + 1) % 3] * sync.fullSize[(d + 2) % 3]);
+            }
+            if (maxLayerNumElements * synchronizer->getElementSizeBytes() > INT_MAX)
+                PICMDK_THROW(SynchronizationException, ("dataset '" + sync.name + "' has ghost layers exceeding the limit of MPI counts"));
+            sync.haloSendBuffer.resize(maxLayerNumElements * synchronizer->getElementSizeBytes());
+            sync.haloRecvBuffer.resize(maxLayerNumElements * synchronizer->getElementSizeBytes());
+            continue;
+        }
+
+        if (synchronizer->getMPIUserFunction())
+            setCustomMPIOp(sync);
+        if (synchronizer->getMPIDatatype() == MPI_DATATYPE_NULL)
+            PICMDK_THROW(SynchronizationException, ("dataset '" + sync.name + "' has element type not supported for global synchronization"));
+
+        if (sync.locality == SynchronizationMode::ReduceScatter) {
+            sync.storage.resize(sync.sizeBytes);
+            long long sliceSizeBytes = exportData[sync.exportIdx[0]].dataSet->getSliceNumElements() * synchronizer->getElementSizeBytes();
+            int numSlices = sliceSizeBytes ? (int)(sync.sizeBytes / sliceSizeBytes) : 0;
+            long long sliceCount = numSlices ? synchronizer->getMPICount() / numSlices : 0;
+            int numProcesses = communicator->getNumProcesses();
+            sync.recvCounts.resize(numProcesses);
+            for (int p = 0; p < numProcesses; p++) {
+                int begin = (int)((long long)numSlices * p / numProcesses);
+                int end = (int)((long long)numSlices * (p + 1) / numProcesses);
+                if ((end - begin) * sliceCount > INT_MAX)
+                    PICMDK_THROW(SynchronizationException, ("dataset '" + sync.name + "' has a ReduceScatter slab exceeding the limit of MPI counts"));
+                sync.recvCounts[p] = (int)((end - begin) * sliceCount);
+                if (p == communicator->getRank()) {
+                    sync.sliceBegin = begin;
+                    sync.sliceEnd = end;
+                }
+            }
+            sync.resultOffsetBytes = sync.sliceBegin * sliceSizeBytes;
+            sync.resultSizeBytes = (sync.sliceEnd - sync.sliceBegin) * sliceSizeBytes;
+            sync.recvStorage.resize(sync.resultSizeBytes);
+            continue;
+        }
 
+        int bucketIdx = -1;
+        for (int b = 0; b < (int)synchronizationBuckets.size(); b++)
+            if ((synchronizationBuckets[b].op == synchronizer->getMPIOp()) &&
+                (synchronizationBuckets[b].datatype == synchronizer->getMPIDatatype()) &&
+                (synchronizationBuckets[b].schedule == sync.schedule) &&
+                (synchronizationBuckets[b].locality == sync.locality) &&
+                (synchronizationBuckets[b].root == sync.root))
+                bucketIdx = b;
+        if (bucketIdx < 0) {
+            SynchronizationBucket bucket;
+            bucket.op = synchronizer->getMPIOp();
+            bucket.datatype = synchronizer->getMPIDatatype();
+            bucket.schedule = sync.schedule;
+            bucket.locality = sync.locality;
+            bucket.root = sync.root;
+            bucket.count = 0;
+            bucket.isPending = false;
+            bucket.isPreviousPending = false;
+            bucket.window = MPI_WIN_NULL;
+            bucket.nodeResult = 0;
+            synchronizationBuckets.push_back(bucket);
+            bucketIdx = (int)synchronizationBuckets.size() - 1;
+        }
+        SynchronizationBucket& bucket = synchronizationBuckets[bucketIdx];
+        bucket.synchronizationIdx.push_back(i);
+        bucket.count += synchronizer->getMPICount();
+        sync.bucketIdx = bucketIdx;
+    }
+
+    // Total numbers of contributors for all global synchronizations in one collective
+    if (!numContributors.empty()) {
+        std::vector<int> totalNumContributors(numContributors.size());
+        communicator->allreduce(&numContributors[0], &totalNumContributors[0], (int)numContributors.size(), MPI_INT, MPI_SUM);
+        for (size_t i = 0, globalIdx = 0; i < synchronizationData.size(); i++)
+            if (synchronizationData[i].isGlobal && !isGather(synchronizationData[i].operation))
+                synchronizationData[i].numContributors = totalNumContributors[globalIdx++];
+    }
+
+    // Buffers are set after all storage is allocated, so the pointers stay valid
+    for (size_t i = 0; i < synchronizationData.size(); i++) {
+        SynchronizationDescription& sync = synchronizationData[i];
+        sync.buffer = sync.storage.empty() ? 0 : &sync.storage[0];
+        sync.result = sync.buffer;
+        if (sync.locality == SynchronizationMode::ReduceScatter)
+            sync.result = sync.recvStorage.empty() ? 0 : &sync.recvStorage[0];
+    }
+    for (size_t b = 0; b < synchronizationBuckets.size(); b++) {
+        SynchronizationBucket& bucket = synchronizationBuckets[b];
+        long long sizeBytes = 0;
+        for (size_t k = 0; k < bucket.synchronizationIdx.size(); k++)
+            sizeBytes += synchronizationData[bucket.synchronizationIdx[k]].sizeBytes;
+        bucket.sendBuffer.resize(sizeBytes);
+        bucket.recvBuffer.resize(sizeBytes);
+        if (isDoubleBuffering) {
+            bucket.previousSendBuffer.resize(sizeBytes);
+            bucket.previousRecvBuffer.resize(sizeBytes);
+        }
+        for (size_t k = 0, offset = 0; k < bucket.synchronizationIdx.size(); k++) {
+            SynchronizationDescription& sync = synchronizationData[bucket.synchronizationIdx[k]];
+            sync.bucketOffsetBytes = (long long)offset;
+            sync.buffer = sizeBytes ? &bucket.sendBuffer[offset] : 0;
+            sync.result = sizeBytes ? &bucket.recvBuffer[offset] : 0;
+            offset += sync.sizeBytes;
+        }
+    }
+    if (isNodeReduction && communicator)
+        createNodeReduction();
+
+    reductionChunks.clear();
+    reductionSizeBytes = 0;
+    lazyExportIdx.clear();
+    for (int i = 0; i < (int)synchronizationData.size(); i++) {
+        SynchronizationDescription& sync = synchronizationData[i];
+        if (isGather(sync.operation) || !sync.sizeBytes)
+            continue;
+        int elementSizeBytes = exportData[sync.exportIdx[0]].synchronizer->getElementSizeBytes();
+        long long numElements = sync.sizeBytes / elementSizeBytes;
+        int chunkNumElements = std::max(reductionChunkSizeBytes / elementSizeBytes, 1);
+        for (long long begin = 0; begin < numElements; begin += chunkNumElements) {
+            ReductionChunk chunk;
+            chunk.synchronizationIdx = i;
+            chunk.offsetBytes = begin * elementSizeBytes;
+            chunk.numElements = (int)std::min((long long)chunkNumElements, numElements - begin);
+            reductionChunks.push_back(chunk);
+        }
+        reductionSizeBytes += sync.sizeBytes * (long long)sync.exportIdx.size();
+        for (size_t j = 0; j < sync.exportIdx.size(); j++)
+            if (exportData[sync.exportIdx[j]].isLazy)
+                lazyExportIdx.push_back(sync.exportIdx[j]);
+    }
 }
 
+// Synchronization is done in two levels: first all copies of an exported dataset
+// in this process are reduced to a single buffer, then in case of global
+// synchronization the buffers are reduced between processes with one
+// collective per bucket. Exported data is not used after the first level,
+// so it is finalized right away and can be changed during the second level.
 void InterData::synchronizeAll()
 {
+    waitReusedBuffers();
+    for (size_t i = 0; i < synchronizationData.size(); i++)
+        synchronizationData[i].isActive = true;
+    if (isDirtyTracking)
+        skipCleanSynchronizations();
+    startSynchronization();
+}
 
+void InterData::synchronize(Event::Type event, int iteration)
+{
+    waitReusedBuffers();
+    bool isAnyActive = false;
+    for (size_t i = 0; i < synchronizationData.size(); i++) {
+        synchronizationData[i].isActive = isScheduled(synchronizationData[i], event, iteration);
+        isAnyActive = isAnyActive || synchronizationData[i].isActive;
+    }
+    if (isAnyActive && isDirtyTracking)
+        skipCleanSynchronizations();
+    if (isAnyActive)
+        startSynchronization();
 }
 
+// Synchronization with no modified copies gives the same result as the last one
+// in case of Keep finalization, in case of Clear the copies have been cleared,
+// so after one more synchronization the result stays the same.
+// Modification flags of global synchronizations are packed into a bitmask
+// and combined between processes with a bitwise or.
+void InterData::skipCleanSynchronizations()
+{
+    const int bitsPerWord = 8 * sizeof(unsigned);
+    std::vector<unsigned> localMask, globalMask;
+    int numGlobal = 0;
+    for (size_t i = 0; i < synchronizationData.size(); i++) {
+        const SynchronizationDescription& sync = synchronizationData[i];
+        if (!sync.isActive || !sync.isGlobal)
+            continue;
+        if (numGlobal % bitsPerWord == 0)
+            localMask.push_back(0);
+        if (isDirty(sync))
+            localMask.back() |= 1u << (numGlobal % bitsPerWord);
+        numGlobal++;
+    }
+    if (numGlobal) {
+        globalMask.resize(localMask.size());
+        communicator->allreduce(&localMask[0], &globalMask[0], (int)localMask.size(), MPI_UNSIGNED, MPI_BOR);
+    }
+
+    for (size_t i = 0, globalIdx = 0; i < synchronizationData.size(); i++) {
+        SynchronizationDescription& sync = synchronizationData[i];
+        if (!sync.isActive)
+            continue;
+        bool isSyncDirty = isDirty(sync);
+        if (sync.isGlobal) {
+            isSyncDirty = (globalMask[globalIdx / bitsPerWord] >> (globalIdx % bitsPerWord)) & 1u;
+            globalIdx++;
+        }
+        bool isCleared = exportData[sync.exportIdx[0]].isCleared;
+        if (!isSyncDirty && (!isCleared || !sync.wasDirty))
+            sync.isActive = false;
+        sync.wasDirty = isSyncDirty;
+    }
+}
+
+bool InterData::isDirty(const SynchronizationDescription& sync) const
+{
+    for (size_t j = 0; j < sync.exportIdx.size(); j++) {
+        const ExportDescription& exportDescription = exportData[sync.exportIdx[j]];
+        if (exportDescription.dataSet->isDirty)
+            return true;
+        for (size_t k = 0; k < exportDescription.sharedCopies.size(); k++)
+            if (exportDescription.sharedCopies[k]->isDirty)
+                return true;
+    }
+    return false;
+}
+
+bool InterData::isScheduled(const SynchronizationDescription& sync, Event::Type event, int iteration) const
+{
+    if ((sync.schedule.event != event) || (iteration % sync.schedule.period))
+        return false;
+    if (!sync.schedule.onlyActiveImporters)
+        return true;
+    for (size_t j = 0; j < sync.importIdx.size(); j++)
+        if (importData[sync.importIdx[j]].handler->isActiveIteration())
+            return true;
+    return false;
+}
+
+void InterData::startSynchronization()
+{
+    // Buffers of buckets are swapped before the thread-level stage writes them
+    if (isDoubleBuffering && isAsynchronous)
+        for (size_t b = 0; b < synchronizationBuckets.size(); b++)
+            swapBucketBuffers(synchronizationBuckets[b]);
+
+    // Thread-level stage of all reductions, chunks of all synchronizations are distributed between threads
+    for (size_t i = 0; i < lazyExportIdx.size(); i++) {
+        ExportDescription& exportDescription = exportData[lazyExportIdx[i]];
+        if (!synchronizationData[exportDescription.synchronizationIdx].isActive)
+            continue;
+        MemoryArena::getTouchedPages(exportDescription.dataSet->getRaw(), exportDescription.dataSet->getRawSizeBytes(),
+            exportDescription.isPageTouched);
+    }
+    int numChunks = (int)reductionChunks.size();
+    #pragma omp parallel for schedule(dynamic) if (reductionSizeBytes >= minParallelReductionSizeBytes)
+    for (int c = 0; c < numChunks; c++)
+        reduceChunk(reductionChunks[c]);
+    // Clearing lazy copies releases their pages instead of touching all of them
+    for (size_t i = 0; i < lazyExportIdx.size(); i++) {
+        ExportDescription& exportDescription = exportData[lazyExportIdx[i]];
+        if (exportDescription.isCleared && synchronizationData[exportDescription.synchronizationIdx].isActive)
+            MemoryArena::releasePages(exportDescription.dataSet->getRaw(), exportDescription.dataSet->getRawSizeBytes());
+    }
+
+    for (size_t i = 0; i < synchronizationData.size(); i++) {
+        SynchronizationDescription& sync = synchronizationData[i];
+        if (!sync.isActive)
+            continue;
+        // Data of the copies is taken, so they are clean until modified again
+        for (size_t j = 0; j < sync.exportIdx.size(); j++) {
+            ExportDescription& exportDescription = exportData[sync.exportIdx[j]];
+            exportDescription.dataSet->isDirty = false;
+            for (size_t k = 0; k < exportDescription.sharedCopies.size(); k++)
+                exportDescription.sharedCopies[k]->isDirty = false;
+        }
+        if (isGather(sync.operation))
+            startGather(sync);
+        else if (sync.locality == SynchronizationMode::ReduceScatter)
+            startReduceScatter(sync);
+        else if (sync.locality == SynchronizationMode::Halo) {
+            exchangeHalo(sync);
+            finishSynchronization(sync);
+        }
+        else if (sync.sizeBytes && (sync.bucketIdx < 0))
+            finishSynchronization(sync);
+    }
+
+    for (size_t b = 0; b < synchronizationBuckets.size(); b++) {
+        SynchronizationBucket& bucket = synchronizationBuckets[b];
+        std::vector<int> activeIdx;
+        for (size_t k = 0; k < bucket.synchronizationIdx.size(); k++)
+            if (synchronizationData[bucket.synchronizationIdx[k]].isActive)
+                activeIdx.push_back(bucket.synchronizationIdx[k]);
+        if (!bucket.count || activeIdx.empty())
+            continue;
+        bucket.activeIdx.swap(activeIdx);
+        if (bucket.window != MPI_WIN_NULL) {
+            startNodeReduction(bucket);
+            if (!isAsynchronous)
+                completeBucket(bucket);
+            continue;
+        }
+        reduceBucket(bucket, communicator, &bucket.sendBuffer[0], &bucket.recvBuffer[0]);
+        bucket.isPending = isAsynchronous;
+        if (!isAsynchronous)
+            completeBucket(bucket);
+    }
+}
+
+void InterData::waitSynchronization(const Handler* handler)
+{
+    std::map<const Handler*, std::vector<int> >::const_iterator handlerSyncs = synchronizationIdxByHandler.find(handler);
+    if (handlerSyncs == synchronizationIdxByHandler.end())
+        return;
+    for (size_t i = 0; i < handlerSyncs->second.size(); i++) {
+        SynchronizationDescription& sync = synchronizationData[handlerSyncs->second[i]];
+        if (sync.isPending && isGather(sync.operation))
+            completeGather(sync);
+        else if (sync.isPending)
+            completeReduceScatter(sync);
+        if ((sync.bucketIdx >= 0) && (synchronizationBuckets[sync.bucketIdx].isPending ||
+            synchronizationBuckets[sync.bucketIdx].isPreviousPending))
+            completeBucket(synchronizationBuckets[sync.bucketIdx]);
+    }
+}
+
+void InterData::waitSynchronizationAll()
+{
+    for (size_t i = 0; i < synchronizationData.size(); i++)
+        if (synchronizationData[i].isPending && isGather(synchronizationData[i].operation))
+            completeGather(synchronizationData[i]);
+        else if (synchronizationData[i].isPending)
+            completeReduceScatter(synchronizationData[i]);
+    for (size_t b = 0; b < synchronizationBuckets.size(); b++)
+        if (synchronizationBuckets[b].isPending || synchronizationBuckets[b].isPreviousPending)
+            completeBucket(synchronizationBuckets[b]);
+}
+
+// Without double buffering all buffers are reused, so the previous synchronization must be completed.
+// With double buffering buckets are completed as needed when swapping their buffers,
+// buckets with node-level reduction have their data in a single window and are not swapped.
+void InterData::waitReusedBuffers()
+{
+    if (!isDoubleBuffering || !isAsynchronous) {
+        waitSynchronizationAll();
+        return;
+    }
+    for (size_t i = 0; i < synchronizationData.size(); i++)
+        if (synchronizationData[i].isPending && isGather(synchronizationData[i].operation))
+            completeGather(synchronizationData[i]);
+        else if (synchronizationData[i].isPending)
+            completeReduceScatter(synchronizationData[i]);
+    for (size_t b = 0; b < synchronizationBuckets.size(); b++)
+        if (synchronizationBuckets[b].isPending && (synchronizationBuckets[b].window != MPI_WIN_NULL))
+            completeBucket(synchronizationBuckets[b]);
+}
+
+// Reduce the chunk of all copies into the buffer and finalize the chunk of each copy
+// while it is still in cache. Untouched chunks of lazy copies are zero and skipped,
+// so that reading them does not allocate pages.
+void InterData::reduceChunk(const ReductionChunk& chunk)
+{
+    SynchronizationDescription& sync = synchronizationData[chunk.synchronizationIdx];
+    if (!sync.isActive)
+        return;
+    SynchronizerBase* synchronizer = sync.synchronizer;
+    int sizeBytes = chunk.numElements * synchronizer->getElementSizeBytes();
+    char* buffer = sync.buffer + chunk.offsetBytes;
+    bool isBufferSet = false;
+    for (size_t j = 0; j < sync.sources.size(); j++) {
+        if (!isTouched(exportData[sync.exportIdx[j]], chunk.offsetBytes, sizeBytes))
+            continue;
+        char* data = sync.sources[j] + chunk.offsetBytes;
+        if (isBufferSet)
+            synchronizer->run(buffer, data, chunk.numElements);
+        else
+            std::memcpy(buffer, data, sizeBytes);
+        isBufferSet = true;
+    }
+    if (!isBufferSet)
+        std::memset(buffer, 0, sizeBytes);
+    for (size_t j = 0; j < sync.exportIdx.size(); j++) {
+        const ExportDescription& exportDescription = exportData[sync.exportIdx[j]];
+        if (!exportDescription.isLazy)
+            exportDescription.finalizer->run(sync.sources[j] + chunk.offsetBytes, chunk.numElements);
+    }
+}
+
+bool InterData::isTouched(const ExportDescription& exportDescription, long long offsetBytes, int sizeBytes) const
+{
+    if (!exportDescription.isLazy)
+        return true;
+    size_t pageSize = MemoryArena::getPageSize();
+    for (size_t page = offsetBytes / pageSize; page <= (offsetBytes + sizeBytes - 1) / pageSize; page++)
+        if ((page < exportDescription.isPageTouched.size()) && exportDescription.isPageTouched[page])
+            return true;
+    return false;
+}
+
+void InterData::setCustomMPIOp(SynchronizationDescription& sync)
+{
+    SynchronizerBase* synchronizer = exportData[sync.exportIdx[0]].synchronizer;
+    MPI_User_function* function = synchronizer->getMPIUserFunction();
+    int elementSizeBytes = synchronizer->getElementSizeBytes();
+    if (!customOps.count(function))
+        customOps[function] = Communicator::createOp(function, true);
+    if (!customDatatypes.count(elementSizeBytes))
+        customDatatypes[elementSizeBytes] = Communicator::createContiguousDatatype(elementSizeBytes);
+    for (size_t j = 0; j < sync.exportIdx.size(); j++)
+        exportData[sync.exportIdx[j]].synchronizer->setMPIOp(customOps[function], customDatatypes[elementSizeBytes]);
+}
+
+// Buckets with Root locality are not reduced at the node level, as the result is needed only on one process.
+// The node communicators are created once, the windows are created for each plan, as the buckets change.
+// Collective on the node communicators, so the buckets must match between processes.
+void InterData::createNodeReduction()
+{
+    if (!nodeCommunicator.get()) {
+        nodeCommunicator = communicator->splitShared();
+        int color = (nodeCommunicator->getRank() == 0) ? 0 : MPI_UNDEFINED;
+        leaderCommunicator = communicator->split(color, communicator->getRank());
+    }
+    int nodeSize = nodeCommunicator->getNumProcesses(), maxNodeSize = 0;
+    communicator->allreduce(&nodeSize, &maxNodeSize, 1, MPI_INT, MPI_MAX);
+    if (maxNodeSize == 1)
+        return;
+    int nodeRank = nodeCommunicator->getRank();
+    for (size_t b = 0; b < synchronizationBuckets.size(); b++) {
+        SynchronizationBucket& bucket = synchronizationBuckets[b];
+        long long sizeBytes = (long long)bucket.sendBuffer.size();
+        if ((bucket.locality != SynchronizationMode::Global) || !sizeBytes)
+            continue;
+        nodeCommunicator->allocateSharedWindow(nodeRank ? sizeBytes : 2 * sizeBytes, &bucket.window);
+        bucket.nodeBuffers.resize(nodeSize);
+        for (int q = 0; q < nodeSize; q++)
+            bucket.nodeBuffers[q] = (char*)nodeCommunicator->getSharedWindowSegment(bucket.window, q);
+        bucket.nodeResult = bucket.nodeBuffers[0] + sizeBytes;
+        // The thread-level stage reduces directly into the segment of this process
+        for (size_t k = 0; k < bucket.synchronizationIdx.size(); k++) {
+            SynchronizationDescription& sync = synchronizationData[bucket.synchronizationIdx[k]];
+            sync.buffer = bucket.nodeBuffers[nodeRank] + sync.bucketOffsetBytes;
+        }
+    }
+}
+
+void InterData::freeNodeReduction()
+{
+    for (size_t b = 0; b < synchronizationBuckets.size(); b++)
+        if (synchronizationBuckets[b].window != MPI_WIN_NULL)
+            nodeCommunicator->freeSharedWindow(&synchronizationBuckets[b].window);
+}
+
+// Each process of the node reduces its part of the elements of each active synchronization
+// from the segments of all processes into the segment of the first process, which then
+// takes part in the collective between nodes. The result is copied to recvBuffer of all
+// processes of the node by completeBucket(). Segments are written again only by the next
+// synchronization after all processes have passed the synchronization of the window here.
+void InterData::startNodeReduction(SynchronizationBucket& bucket)
+{
+    nodeCommunicator->synchronizeSharedWindow(bucket.window);
+    int nodeRank = nodeCommunicator->getRank();
+    int nodeSize = nodeCommunicator->getNumProcesses();
+    for (size_t k = 0; k < bucket.synchronizationIdx.size(); k++) {
+        SynchronizationDescription& sync = synchronizationData[bucket.synchronizationIdx[k]];
+        if (!sync.isActive)
+            continue;
+        int elementSizeBytes = sync.synchronizer->getElementSizeBytes();
+        long long numElements = sync.sizeBytes / elementSizeBytes;
+        long long begin = numElements * nodeRank / nodeSize;
+        long long end = numElements * (nodeRank + 1) / nodeSize;
+        // Chunk by chunk, so that the chunk of the result stays in cache
+        int chunkNumElements = std::max(reductionChunkSizeBytes / elementSizeBytes, 1);
+        for (long long chunkBegin = begin; chunkBegin < end; chunkBegin += chunkNumElements) {
+            long long offsetBytes = sync.bucketOffsetBytes + chunkBegin * elementSizeBytes;
+            int numChunkElements = (int)std::min((long long)chunkNumElements, end - chunkBegin);
+            for (int q = 1; q < nodeSize; q++)
+                sync.synchronizer->run(bucket.nodeBuffers[0] + offsetBytes, bucket.nodeBuffers[q] + offsetBytes, numChunkElements);
+        }
+    }
+    nodeCommunicator->synchronizeSharedWindow(bucket.window);
+    bucket.requests.clear();
+    if (leaderCommunicator.get())
+        reduceBucket(bucket, leaderCommunicator.get(), bucket.nodeBuffers[0], bucket.nodeResult);
+    bucket.isPending = isAsynchronous;
+}
+
+// Only buckets with a collective in flight and active synchronizations this time are swapped,
+// the collective started before the one in flight is completed to free its buffers
+void InterData::swapBucketBuffers(SynchronizationBucket& bucket)
+{
+    if (!bucket.isPending || (bucket.window != MPI_WIN_NULL))
+        return;
+    bool isActive = false;
+    for (size_t k = 0; k < bucket.synchronizationIdx.size(); k++)
+        isActive = isActive || synchronizationData[bucket.synchronizationIdx[k]].isActive;
+    if (!isActive)
+        return;
+    completePreviousBucket(bucket);
+    bucket.sendBuffer.swap(bucket.previousSendBuffer);
+    bucket.recvBuffer.swap(bucket.previousRecvBuffer);
+    bucket.activeIdx.swap(bucket.previousActiveIdx);
+    bucket.requests.swap(bucket.previousRequests);
+    bucket.isPreviousPending = true;
+    bucket.isPending = false;
+    for (size_t k = 0; k < bucket.synchronizationIdx.size(); k++) {
+        SynchronizationDescription& sync = synchronizationData[bucket.synchronizationIdx[k]];
+        sync.buffer = &bucket.sendBuffer[sync.bucketOffsetBytes];
+    }
+}
+
+// Root locality is only for buckets not reduced at the node level, so the root is a rank of bucketCommunicator
+void InterData::reduceBucket(SynchronizationBucket& bucket, Communicator* bucketCommunicator, char* sendBuffer, char* recvBuffer)
+{
+    bool isRoot = (bucket.locality == SynchronizationMode::Root);
+    long long countSizeBytes = (long long)bucket.sendBuffer.size() / bucket.count;
+    int numParts = (int)((bucket.count + maxCollectiveCount - 1) / maxCollectiveCount);
+    bucket.requests.assign(isAsynchronous ? numParts : 0, MPI_REQUEST_NULL);
+    for (int i = 0; i < numParts; i++) {
+        long long begin = i * maxCollectiveCount;
+        int count = (int)std::min(maxCollectiveCount, bucket.count - begin);
+        char* partSendBuffer = sendBuffer + begin * countSizeBytes;
+        char* partRecvBuffer = recvBuffer + begin * countSizeBytes;
+        if (isAsynchronous && isRoot)
+            bucketCommunicator->ireduce(partSendBuffer, partRecvBuffer, count, bucket.datatype, bucket.op,
+                bucket.root, &bucket.requests[i]);
+        else if (isAsynchronous)
+            bucketCommunicator->iallreduce(partSendBuffer, partRecvBuffer, count, bucket.datatype, bucket.op,
+                &bucket.requests[i]);
+        else if (isRoot)
+            bucketCommunicator->reduce(partSendBuffer, partRecvBuffer, count, bucket.datatype, bucket.op, bucket.root);
+        else
+            bucketCommunicator->allreduce(partSendBuffer, partRecvBuffer, count, bucket.datatype, bucket.op);
+    }
+}
+
+void InterData::completePreviousBucket(SynchronizationBucket& bucket)
+{
+    if (!bucket.isPreviousPending)
+        return;
+    MPI_Status status;
+    for (size_t i = 0; i < bucket.previousRequests.size(); i++)
+        communicator->wait(&bucket.previousRequests[i], &status);
+    bucket.isPreviousPending = false;
+    finishBucket(bucket.previousRecvBuffer, bucket.previousActiveIdx);
+}
+
+// Results of synchronizations in buckets are only used here, so result is set to the buffer finished
+void InterData::finishBucket(std::vector<char>& recvBuffer, const std::vector<int>& activeIdx)
+{
+    for (size_t k = 0; k < activeIdx.size(); k++) {
+        SynchronizationDescription& sync = synchronizationData[activeIdx[k]];
+        sync.result = &recvBuffer[sync.bucketOffsetBytes];
+        finishSynchronization(sync);
+    }
+}
+
+void InterData::completeBucket(SynchronizationBucket& bucket)
+{
+    completePreviousBucket(bucket);
+    if (bucket.isPending) {
+        MPI_Status status;
+        for (size_t i = 0; i < bucket.requests.size(); i++)
+            communicator->wait(&bucket.requests[i], &status);
+        bucket.isPending = false;
+    }
+    if (bucket.window != MPI_WIN_NULL) {
+        nodeCommunicator->synchronizeSharedWindow(bucket.window);
+        std::memcpy(&bucket.recvBuffer[0], bucket.nodeResult, bucket.recvBuffer.size());
+    }
+    finishBucket(bucket.recvBuffer, bucket.activeIdx);
+}
+
+// With Root locality other processes have no result
+void InterData::finishSynchronization(SynchronizationDescription& sync)
+{
+    if (!sync.resultSizeBytes)
+        return;
+    if ((sync.locality == SynchronizationMode::Root) && (communicator->getRank() != sync.root))
+        return;
+    sync.synchronizer->finalize(sync.result, sync.resultSizeBytes / sync.synchronizer->getElementSizeBytes(),
+        sync.numContributors);
+    for (size_t j = 0; j < sync.destinations.size(); j++)
+        std::memcpy(sync.destinations[j] + sync.resultOffsetBytes, sync.result, sync.resultSizeBytes);
+}
+
+void InterData::startReduceScatter(SynchronizationDescription& sync)
+{
+    if (!sync.sizeBytes)
+        return;
+    SynchronizerBase* synchronizer = sync.synchronizer;
+    if (isAsynchronous) {
+        communicator->ireduceScatter(sync.buffer, sync.result, &sync.recvCounts[0],
+            synchronizer->getMPIDatatype(), synchronizer->getMPIOp(), &sync.request);
+        sync.isPending = true;
+    }
+    else {
+        communicator->reduceScatter(sync.buffer, sync.result, &sync.recvCounts[0],
+            synchronizer->getMPIDatatype(), synchronizer->getMPIOp());
+        finishSynchronization(sync);
+    }
+}
+
+void InterData::completeReduceScatter(SynchronizationDescription& sync)
+{
+    MPI_Status status;
+    communicator->wait(&sync.request, &status);
+    sync.isPending = false;
+    finishSynchronization(sync);
+}
+
+// Dimensions are processed one by one with layers spanning the whole array along the other
+// dimensions, so that values in corners reach the diagonal neighbours in several steps.
+// Accumulation along a dimension excludes ghost layers of the previous dimensions,
+// as their values have already been passed on.
+// Halo exchange is blocking also in asynchronous mode.
+void InterData::exchangeHalo(SynchronizationDescription& sync)
+{
+    if (!sync.sizeBytes || !sync.ghostWidth)
+        return;
+    int ghostWidth = sync.ghostWidth;
+    Vector3<int> begin(0, 0, 0), end = sync.fullSize;
+    if (sync.operation == SynchronizationMode::Sum)
+        for (int d = 0; d < 3; d++) {
+            int numCells = sync.fullSize[d] - 2 * ghostWidth;
+            int lower = neighbourRanks[2 * d], upper = neighbourRanks[2 * d + 1];
+            exchangeHaloLayer(sync, d, begin, end, numCells + ghostWidth, upper, ghostWidth, lower, true);
+            exchangeHaloLayer(sync, d, begin, end, 0, lower, numCells, upper, true);
+            begin[d] = ghostWidth;
+            end[d] = numCells + ghostWidth;
+        }
+    begin = Vector3<int>(0, 0, 0);
+    end = sync.fullSize;
+    for (int d = 0; d < 3; d++) {
+        int numCells = sync.fullSize[d] - 2 * ghostWidth;
+        int lower = neighbourRanks[2 * d], upper = neighbourRanks[2 * d + 1];
+        exchangeHaloLayer(sync, d, begin, end, ghostWidth, lower, numCells + ghostWidth, upper, false);
+        exchangeHaloLayer(sync, d, begin, end, numCells, upper, 0, lower, false);
+    }
+}
+
+// A single domain along a periodic dimension is its own neighbour, then the layer is copied locally
+void InterData::exchangeHaloLayer(SynchronizationDescription& sync, int dim, const Vector3<int>& layerBegin,
+    const Vector3<int>& layerEnd, int sendBegin, int dest, int recvBegin, int source, bool isAccumulated)
+{
+    Vector3<int> begin = layerBegin, end = layerEnd;
+    begin[dim] = sendBegin;
+    end[dim] = sendBegin + sync.ghostWidth;
+    int layerSizeBytes = (int)(internal::volume(end - begin) * sync.synchronizer->getElementSizeBytes());
+    if (dest != MPI_PROC_NULL)
+        copyBox(sync, begin, end, &sync.haloSendBuffer[0], true, false);
+    char* received = &sync.haloRecvBuffer[0];
+    if (dest == communicator->getRank())
+        received = &sync.haloSendBuffer[0];
+    else if ((dest != MPI_PROC_NULL) || (source != MPI_PROC_NULL)) {
+        MPI_Status status;
+        communicator->sendrecv(&sync.haloSendBuffer[0], layerSizeBytes, MPI_BYTE, dest, haloExchangeTag,
+            received, layerSizeBytes, MPI_BYTE, source, haloExchangeTag, &status);
+    }
+    if (source == MPI_PROC_NULL)
+        return;
+    begin[dim] = recvBegin;
+    end[dim] = recvBegin + sync.ghostWidth;
+    copyBox(sync, begin, end, received, false, isAccumulated);
+}
+
+void InterData::copyBox(SynchronizationDescription& sync, const Vector3<int>& begin, const Vector3<int>& end,
+    char* boxBuffer, bool isPacking, bool isAccumulated)
+{
+    int elementSizeBytes = sync.synchronizer->getElementSizeBytes();
+    int rowNumElements = end.z - begin.z;
+    int rowSizeBytes = rowNumElements * elementSizeBytes;
+    for (int i = begin.x; i < end.x; i++)
+        for (int j = begin.y; j < end.y; j++) {
+            char* row = sync.buffer + (((long long)i * sync.fullSize.y + j) * sync.fullSize.z + begin.z) * elementSizeBytes;
+            if (isPacking)
+                std::memcpy(boxBuffer, row, rowSizeBytes);
+            else if (isAccumulated)
+                sync.synchronizer->run(row, boxBuffer, rowNumElements);
+            else
+                std::memcpy(row, boxBuffer, rowSizeBytes);
+            boxBuffer += rowSizeBytes;
+        }
+}
+
+// Copies of the dataset are concatenated in order of threads, then for global gathers
+// sizes are exchanged and the data is gathered directly to the first import
+// on the receiving processes (the root for Gather, all for AllGather)
+void InterData::startGather(SynchronizationDescription& sync)
+{
+    long long sendSizeBytes = 0;
+    for (size_t j = 0; j < sync.exportIdx.size(); j++)
+        sendSizeBytes += exportData[sync.exportIdx[j]].dataSet->getRawSizeBytes();
+    sync.storage.resize(sendSizeBytes);
+    sync.buffer = sendSizeBytes ? &sync.storage[0] : 0;
+    for (size_t j = 0, offset = 0; j < sync.exportIdx.size(); j++) {
+        ExportDescription& exportDescription = exportData[sync.exportIdx[j]];
+        long long sizeBytes = exportDescription.dataSet->getRawSizeBytes();
+        if (sizeBytes)
+            exportDescription.dataSet->packRaw(sync.buffer + offset);
+        offset += sizeBytes;
+        if (exportDescription.isCleared && !exportDescription.dataSet->clearRaw())
+            exportDescription.finalizer->run(exportDescription.dataSet->getRaw(),
+                sizeBytes / exportDescription.synchronizer->getElementSizeBytes());
+    }
+
+    const int root = sync.root;
+    bool isAllGather = (sync.operation == SynchronizationMode::AllGather);
+    bool isReceiver = true;
+    sync.sizeBytes = sendSizeBytes;
+    // Gathered data is in bytes with int displacements, so it is limited by the range of MPI counts
+    if (sync.isGlobal) {
+        if (sendSizeBytes > INT_MAX)
+            PICMDK_THROW(SynchronizationException, ("dataset '" + sync.name + "' has gathered data exceeding the limit of MPI counts"));
+        int sendCount = (int)sendSizeBytes;
+        int numProcesses = communicator->getNumProcesses();
+        sync.recvCounts.resize(numProcesses);
+        sync.displs.resize(numProcesses);
+        if (isAllGather)
+            communicator->allgather(&sendCount, 1, MPI_INT, &sync.recvCounts[0], 1, MPI_INT);
+        else
+            communicator->gather(&sendCount, 1, MPI_INT, &sync.recvCounts[0], 1, MPI_INT, root);
+        isReceiver = isAllGather || (communicator->getRank() == root);
+        sync.sizeBytes = 0;
+        if (isReceiver)
+            for (int p = 0; p < numProcesses; p++) {
+                if (sync.sizeBytes + sync.recvCounts[p] > INT_MAX)
+                    PICMDK_THROW(SynchronizationException, ("dataset '" + sync.name + "' has gathered data exceeding the limit of MPI counts"));
+                sync.displs[p] = (int)sync.sizeBytes;
+                sync.sizeBytes += sync.recvCounts[p];
+            }
+    }
+
+    // Processes not receiving the data have the imports emptied
+    sync.result = 0;
+    for (size_t j = 0; j < sync.importIdx.size(); j++) {
+        DataSetBase* dataSet = importData[sync.importIdx[j]].dataSet;
+        if (!dataSet->resizeRawBytes(isReceiver ? sync.sizeBytes : 0))
+            PICMDK_THROW(SynchronizationException, ("dataset '" + sync.name + "' is imported by a dataset which can not be resized for gather"));
+    }
+    if (isReceiver) {
+        if (!sync.importIdx.empty())
+            sync.result = (char*)importData[sync.importIdx[0]].dataSet->getRaw();
+        else {
+            sync.recvStorage.resize(sync.sizeBytes);
+            sync.result = sync.sizeBytes ? &sync.recvStorage[0] : 0;
+        }
+    }
+
+    if (!sync.isGlobal) {
+        if (sync.sizeBytes)
+            std::memcpy(sync.result, sync.buffer, sync.sizeBytes);
+        completeGather(sync);
+    }
+    else if (isAsynchronous) {
+        if (isAllGather)
+            communicator->iallgatherv(sync.buffer, (int)sendSizeBytes, MPI_BYTE, sync.result,
+                &sync.recvCounts[0], &sync.displs[0], MPI_BYTE, &sync.request);
+        else
+            communicator->igatherv(sync.buffer, (int)sendSizeBytes, MPI_BYTE, sync.result,
+                &sync.recvCounts[0], &sync.displs[0], MPI_BYTE, root, &sync.request);
+        sync.isPending = true;
+    }
+    else {
+        if (isAllGather)
+            communicator->allgatherv(sync.buffer, (int)sendSizeBytes, MPI_BYTE, sync.result,
+                &sync.recvCounts[0], &sync.displs[0], MPI_BYTE);
+        else
+            communicator->gatherv(sync.buffer, (int)sendSizeBytes, MPI_BYTE, sync.result,
+                &sync.recvCounts[0], &sync.displs[0], MPI_BYTE, root);
+        completeGather(sync);
+    }
+}
+
+void InterData::completeGather(SynchronizationDescription& sync)
+{
+    if (sync.isPending) {
+        MPI_Status status;
+        communicator->wait(&sync.request, &status);
+        sync.isPending = false;
+    }
+    if (!sync.result || !sync.sizeBytes)
+        return;
+    for (size_t j = 1; j < sync.importIdx.size(); j++)
+        std::memcpy(importData[sync.importIdx[j]].dataSet->getRaw(), sync.result, sync.sizeBytes);
+}
 
 
 } // namespace picmdk
@@ -3,15 +3,38 @@
 /* This is a simple wrapper over MPI_get_rank. */
 #ifndef PICMDK_USE_MPI
 
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
+#include <vector>
+
+
+namespace {
+
+// Sizes in bytes of derived datatypes, datatype MPI_DOUBLE + 1 + i has size derivedDatatypeSizes[i]
+std::vector<size_t> derivedDatatypeSizes;
+
+// Shared memory windows, window i + 1 has the segment windowSegments[i] of windowSizes[i] bytes,
+// the segment is 0 after the window is freed
+std::vector<void*> windowSegments;
+std::vector<MPI_Aint> windowSizes;
+std::vector<int> windowDispUnits;
+
+} // anonymous namespace
 
 
 size_t getSize(MPI_Datatype type)
 {
+    if ((type > MPI_DOUBLE) && (type - MPI_DOUBLE - 1 < (int)derivedDatatypeSizes.size()))
+        return derivedDatatypeSizes[type - MPI_DOUBLE - 1];
     switch (type) {
-        case MPI_MPI_DATATYPE_NULL: return 0;
+        case MPI_DATATYPE_NULL: return 0;
+        case MPI_BYTE: return 1;
         case MPI_CHAR: return sizeof(char);
         case MPI_INT: return sizeof(int);
+        case MPI_UNSIGNED: return sizeof(unsigned int);
+        case MPI_LONG: return sizeof(long);
+        case MPI_LONG_LONG: return sizeof(long long);
         case MPI_FLOAT: return sizeof(float);
         case MPI_DOUBLE: return sizeof(double);
         default: return -1;
@@ -36,6 +59,24 @@ void MPI_Comm_dup(MPI_Comm comm, MPI_Comm* newcomm)
     *newcomm = comm;
 }
 
+int MPI_Comm_split(MPI_Comm comm, int color, int key, MPI_Comm *newcomm)
+{
+    *newcomm = (color == MPI_UNDEFINED) ? MPI_COMM_NULL : comm;
+    return 0;
+}
+
+int MPI_Comm_split_type(MPI_Comm comm, int split_type, int key, MPI_Info info, MPI_Comm *newcomm)
+{
+    *newcomm = comm;
+    return 0;
+}
+
+int MPI_Comm_free(MPI_Comm *comm)
+{
+    *comm = MPI_COMM_NULL;
+    return 0;
+}
+
 int MPI_Barrier(MPI_Comm comm)
 {
     return 0;
@@ -49,7 +90,7 @@ int MPI_Send(const void *buf, int count, MPI_Datatype datatype,
 }
 
 int MPI_Recv(void *buf, int count,
-    MPI_Datatype datatype, int source, int tag, MPI_Status *status, MPI_Comm comm)
+    MPI_Datatype datatype, int source, int tag, MPI_Comm comm, MPI_Status *status)
 {
     /// TODO
     return 1;
@@ -57,10 +98,13 @@ int MPI_Recv(void *buf, int count,
 
 int MPI_Sendrecv(const void *sendbuf, int sendcount,
     MPI_Datatype sendtype, int dest, int sendtag, void *recvbuf, int recvcount,
-    MPI_Datatype recvtype, int source, int recvtag, MPI_Status *status, MPI_Comm comm)
+    MPI_Datatype recvtype, int source, int recvtag, MPI_Comm comm, MPI_Status *status)
 {
-    /// TODO
-    return 1;
+    // The only process exchanges with itself, e.g. for periodic halo exchange
+    if ((dest != 0) || (source != 0) || (sendtag != recvtag))
+        return 1;
+    memcpy(recvbuf, sendbuf, std::min(sendcount * getSize(sendtype), recvcount * getSize(recvtype)));
+    return 0;
 }
 
 int MPI_Bcast(void *buffer, int count, MPI_Datatype datatype, int root, MPI_Comm comm)
@@ -81,6 +125,27 @@ int MPI_Gather(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
         return 1;
 }
 
+int MPI_Gatherv(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+    void *recvbuf, const int *recvcounts, const int *displs, MPI_Datatype recvtype,
+    int root, MPI_Comm comm)
+{
+    return MPI_Gather(sendbuf, sendcount, sendtype, (char*)recvbuf + displs[0] * getSize(recvtype),
+        recvcounts[0], recvtype, root, comm);
+}
+
+int MPI_Allgather(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+    void *recvbuf, int recvcount, MPI_Datatype recvtype, MPI_Comm comm)
+{
+    return MPI_Gather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, 0, comm);
+}
+
+int MPI_Allgatherv(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+    void *recvbuf, const int *recvcounts, const int *displs, MPI_Datatype recvtype,
+    MPI_Comm comm)
+{
+    return MPI_Gatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype, 0, comm);
+}
+
 int MPI_Reduce(const void *sendbuf, void *recvbuf,
     int count, MPI_Datatype datatype, MPI_Op op, int root, MPI_Comm comm)
 {
@@ -88,11 +153,153 @@ int MPI_Reduce(const void *sendbuf, void *recvbuf,
     return 0;
 }
 
-inline int MPI_Allreduce(const void *sendbuf, void *recvbuf,
+int MPI_Allreduce(const void *sendbuf, void *recvbuf,
     int count, MPI_Datatype datatype, MPI_Op op, MPI_Comm comm)
 {
     return MPI_Reduce(sendbuf, recvbuf, count, datatype, op, 0, comm);
 }
 
+int MPI_Reduce_scatter(const void *sendbuf, void *recvbuf, const int *recvcounts,
+    MPI_Datatype datatype, MPI_Op op, MPI_Comm comm)
+{
+    return MPI_Reduce(sendbuf, recvbuf, recvcounts[0], datatype, op, 0, comm);
+}
+
+// Non-blocking operations are done immediately, so requests are always complete
+int MPI_Iallreduce(const void *sendbuf, void *recvbuf, int count,
+    MPI_Datatype datatype, MPI_Op op, MPI_Comm comm, MPI_Request *request)
+{
+    *request = MPI_REQUEST_NULL;
+    return MPI_Allreduce(sendbuf, recvbuf, count, datatype, op, comm);
+}
+
+int MPI_Ireduce(const void *sendbuf, void *recvbuf, int count,
+    MPI_Datatype datatype, MPI_Op op, int root, MPI_Comm comm, MPI_Request *request)
+{
+    *request = MPI_REQUEST_NULL;
+    return MPI_Reduce(sendbuf, recvbuf, count, datatype, op, root, comm);
+}
+
+int MPI_Ireduce_scatter(const void *sendbuf, void *recvbuf, const int *recvcounts,
+    MPI_Datatype datatype, MPI_Op op, MPI_Comm comm, MPI_Request *request)
+{
+    *request = MPI_REQUEST_NULL;
+    return MPI_Reduce_scatter(sendbuf, recvbuf, recvcounts, datatype, op, comm);
+}
+
+int MPI_Igatherv(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+    void *recvbuf, const int *recvcounts, const int *displs, MPI_Datatype recvtype,
+    int root, MPI_Comm comm, MPI_Request *request)
+{
+    *request = MPI_REQUEST_NULL;
+    return MPI_Gatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype, root, comm);
+}
+
+int MPI_Iallgatherv(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+    void *recvbuf, const int *recvcounts, const int *displs, MPI_Datatype recvtype,
+    MPI_Comm comm, MPI_Request *request)
+{
+    *request = MPI_REQUEST_NULL;
+    return MPI_Allgatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype, comm);
+}
+
+// Operations are not used as reductions of a single process are copies
+int MPI_Op_create(MPI_User_function *user_fn, int commute, MPI_Op *op)
+{
+    *op = MPI_OP_NULL;
+    return 0;
+}
+
+// The size is recorded, so that copies done instead of collectives work for derived datatypes as well
+int MPI_Type_contiguous(int count, MPI_Datatype oldtype, MPI_Datatype *newtype)
+{
+    if ((count < 0) || (getSize(oldtype) == (size_t)-1))
+        return 1;
+    derivedDatatypeSizes.push_back(count * getSize(oldtype));
+    *newtype = MPI_DOUBLE + (int)derivedDatatypeSizes.size();
+    return 0;
+}
+
+int MPI_Type_commit(MPI_Datatype *datatype)
+{
+    return 0;
+}
+
+int MPI_Op_free(MPI_Op *op)
+{
+    *op = MPI_OP_NULL;
+    return 0;
+}
+
+// The size of the freed datatype stays recorded, so that datatypes created later get new values
+int MPI_Type_free(MPI_Datatype *datatype)
+{
+    *datatype = MPI_DATATYPE_NULL;
+    return 0;
+}
+
+// A shared memory window of a single process is its segment allocated with malloc
+int MPI_Win_allocate_shared(MPI_Aint size, int disp_unit, MPI_Info info, MPI_Comm comm,
+    void *baseptr, MPI_Win *win)
+{
+    void* segment = std::malloc(size ? size : 1);
+    if (!segment)
+        return 1;
+    windowSegments.push_back(segment);
+    windowSizes.push_back(size);
+    windowDispUnits.push_back(disp_unit);
+    *win = (MPI_Win)windowSegments.size();
+    *(void**)baseptr = segment;
+    return 0;
+}
+
+int MPI_Win_shared_query(MPI_Win win, int rank, MPI_Aint *size, int *disp_unit, void *baseptr)
+{
+    if ((win <= 0) || (win > (int)windowSegments.size()) || !windowSegments[win - 1] || rank)
+        return 1;
+    *size = windowSizes[win - 1];
+    *disp_unit = windowDispUnits[win - 1];
+    *(void**)baseptr = windowSegments[win - 1];
+    return 0;
+}
+
+int MPI_Win_lock_all(int assert, MPI_Win win)
+{
+    return 0;
+}
+
+int MPI_Win_unlock_all(MPI_Win win)
+{
+    return 0;
+}
+
+int MPI_Win_sync(MPI_Win win)
+{
+    return 0;
+}
+
+int MPI_Win_free(MPI_Win *win)
+{
+    if ((*win <= 0) || (*win > (int)windowSegments.size()))
+        return 1;
+    std::free(windowSegments[*win - 1]);
+    windowSegments[*win - 1] = 0;
+    *win = MPI_WIN_NULL;
+    return 0;
+}
+
+int MPI_Wait(MPI_Request *request, MPI_Status *status)
+{
+    *request = MPI_REQUEST_NULL;
+    return 0;
+}
+
+int MPI_Test(MPI_Request *request, int *flag, MPI_Status *status)
+{
+    *request = MPI_REQUEST_NULL;
+    *flag = 1;
+    return 0;
+}
+
 
 #endif
@@ -0,0 +1,252 @@
+#include "MemoryArena.h"
+
+#include "Exception.h"
+#include "OpenMPWrapper.h"
+
+#include <cstdlib>
+
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+#include <cstring>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+
+namespace {
+
+
+size_t roundUp(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+
+} // anonymous namespace
+
+
+namespace picmdk {
+
+
+MemoryArena::MemoryArena(size_t _blockSize):
+    threadBlocks(omp_get_max_threads()),
+    blockSize(_blockSize),
+    useHugePages(false)
+{
+}
+
+MemoryArena::~MemoryArena()
+{
+    for (size_t t = 0; t < threadBlocks.size(); t++)
+        for (size_t i = 0; i < threadBlocks[t].size(); i++)
+            freeBlock(threadBlocks[t][i]);
+}
+
+void MemoryArena::setUseHugePages(bool _useHugePages)
+{
+    useHugePages = _useHugePages;
+}
+
+// Each thread only accesses its own list of blocks, so no synchronization is needed.
+// Large pieces get a dedicated block which is put before the current one
+// so that the remainder of the current block is still used.
+void* MemoryArena::allocate(size_t sizeBytes)
+{
+    std::vector<Block>& blocks = getThreadBlocks();
+    size_t size = roundUp(sizeBytes ? sizeBytes : 1, cacheLineSize);
+
+    if (size > blockSize / 2) {
+        Block block = allocateBlock(size);
+        block.used = size;
+        blocks.insert(blocks.empty() ? blocks.end() : blocks.end() - 1, block);
+        return block.data;
+    }
+    if (blocks.empty() || (blocks.back().used + size > blocks.back().size))
+        blocks.push_back(allocateBlock(blockSize));
+    Block& block = blocks.back();
+    void* result = block.data + block.used;
+    block.used += size;
+    return result;
+}
+
+// Pieces are released from the end of their blocks, so that the space is reused by allocate().
+// Emptied blocks except the current ones are freed
+void MemoryArena::release(void* data, size_t sizeBytes)
+{
+    char* piece = (char*)data;
+    size_t size = roundUp(sizeBytes ? sizeBytes : 1, cacheLineSize);
+    for (size_t t = 0; t < threadBlocks.size(); t++)
+        for (size_t i = 0; i < threadBlocks[t].size(); i++) {
+            Block& block = threadBlocks[t][i];
+            if ((piece < block.data) || (piece >= block.data + block.size))
+                continue;
+            if (piece + size == block.data + block.used)
+                block.used -= size;
+            if (!block.used && (i + 1 < threadBlocks[t].size())) {
+                freeBlock(block);
+                threadBlocks[t].erase(threadBlocks[t].begin() + i);
+            }
+            return;
+        }
+}
+
+// Anonymous mappings are backed by physical pages on first touch,
+// they are not merged into huge pages to keep the page granularity
+void* MemoryArena::allocatePages(size_t sizeBytes)
+{
+    std::vector<Block>& blocks = getThreadBlocks();
+    Block block;
+    block.size = roundUp(sizeBytes ? sizeBytes : 1, getPageSize());
+    block.used = block.size;
+#ifdef __linux__
+    void* data = mmap(0, block.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED)
+        PICMDK_THROW(OutOfMemoryException, (block.size));
+#ifdef MADV_NOHUGEPAGE
+    madvise(data, block.size, MADV_NOHUGEPAGE);
+#endif
+    block.data = (char*)data;
+    block.isMapped = true;
+#else
+    bool oldUseHugePages = useHugePages;
+    useHugePages = false;
+    block = allocateBlock(block.size);
+    useHugePages = oldUseHugePages;
+    block.used = block.size;
+    std::memset(block.data, 0, block.size);
+#endif
+    blocks.insert(blocks.empty() ? blocks.end() : blocks.end() - 1, block);
+    return block.data;
+}
+
+size_t MemoryArena::getPageSize()
+{
+#ifdef __linux__
+    static const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    return pageSize;
+#else
+    return 4096;
+#endif
+}
+
+// Pages are touched if present in memory or swapped out according to /proc/self/pagemap
+void MemoryArena::getTouchedPages(const void* data, size_t sizeBytes, std::vector<bool>& isTouched)
+{
+    size_t pageSize = getPageSize();
+    size_t numPages = roundUp(sizeBytes, pageSize) / pageSize;
+    isTouched.assign(numPages, true);
+#ifdef __linux__
+    static int pagemap = open("/proc/self/pagemap", O_RDONLY);
+    if ((pagemap < 0) || !numPages)
+        return;
+    const unsigned long long presentBit = 1ULL << 63, swappedBit = 1ULL << 62;
+    std::vector<unsigned long long> entries(numPages);
+    off_t offset = (off_t)((size_t)data / pageSize * sizeof(unsigned long long));
+    size_t entriesSize = numPages * sizeof(unsigned long long);
+    if (pread(pagemap, &entries[0], entriesSize, offset) != (ssize_t)entriesSize)
+        return;
+    for (size_t i = 0; i < numPages; i++)
+        isTouched[i] = (entries[i] & (presentBit | swappedBit)) != 0;
+#endif
+}
+
+void MemoryArena::releasePages(void* data, size_t sizeBytes)
+{
+#ifdef __linux__
+    // For private anonymous mappings the released pages read as zero
+    if (madvise(data, roundUp(sizeBytes, getPageSize()), MADV_DONTNEED) == 0)
+        return;
+#endif
+    std::memset(data, 0, sizeBytes);
+}
+
+bool MemoryArena::contains(const void* ptr) const
+{
+    const char* p = (const char*)ptr;
+    for (size_t t = 0; t < threadBlocks.size(); t++)
+        for (size_t i = 0; i < threadBlocks[t].size(); i++)
+            if ((p >= threadBlocks[t][i].data) && (p < threadBlocks[t][i].data + threadBlocks[t][i].size))
+                return true;
+    return false;
+}
+
+size_t MemoryArena::getReservedBytes() const
+{
+    size_t result = 0;
+    for (size_t t = 0; t < threadBlocks.size(); t++)
+        for (size_t i = 0; i < threadBlocks[t].size(); i++)
+            result += threadBlocks[t][i].size;
+    return result;
+}
+
+size_t MemoryArena::getAllocatedBytes() const
+{
+    size_t result = 0;
+    for (size_t t = 0; t < threadBlocks.size(); t++)
+        for (size_t i = 0; i < threadBlocks[t].size(); i++)
+            result += threadBlocks[t][i].used;
+    return result;
+}
+
+// On Linux blocks are mapped rather than taken from the heap, as the heap may give
+// memory already touched by another thread, and so placed on the NUMA node of that thread
+MemoryArena::Block MemoryArena::allocateBlock(size_t size)
+{
+    Block block;
+    block.used = 0;
+    block.isMapped = false;
+#ifdef __linux__
+    block.size = roundUp(size, useHugePages ? hugePageSize : getPageSize());
+    void* mapped = mmap(0, block.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED)
+        PICMDK_THROW(OutOfMemoryException, (block.size));
+    if (useHugePages)
+        madvise(mapped, block.size, MADV_HUGEPAGE);
+    block.data = (char*)mapped;
+    block.isMapped = true;
+#else
+    block.size = roundUp(size, cacheLineSize);
+    void* data = 0;
+#ifdef _MSC_VER
+    data = _aligned_malloc(block.size, cacheLineSize);
+#else
+    if (posix_memalign(&data, cacheLineSize, block.size))
+        data = 0;
+#endif
+    if (!data)
+        PICMDK_THROW(OutOfMemoryException, (block.size));
+    block.data = (char*)data;
+#endif
+    return block;
+}
+
+std::vector<MemoryArena::Block>& MemoryArena::getThreadBlocks()
+{
+    int threadIdx = omp_get_thread_num();
+    if (threadIdx >= (int)threadBlocks.size())
+        PICMDK_THROW(NotImplementedException, ("MemoryArena supports only up to omp_get_max_threads() threads"));
+    return threadBlocks[threadIdx];
+}
+
+void MemoryArena::freeBlock(Block& block)
+{
+#ifdef __linux__
+    if (block.isMapped) {
+        munmap(block.data, block.size);
+        return;
+    }
+#endif
+#ifdef _MSC_VER
+    _aligned_free(block.data);
+#else
+    free(block.data);
+#endif
+}
+
+
+} // namespace picmdk
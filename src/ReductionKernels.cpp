@@ -0,0 +1,214 @@
+#include "ReductionKernels.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define PICMDK_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// Vector kernels of all instruction sets are compiled in the same unit,
+// with GCC-compatible compilers each of them is compiled for its own target
+#if defined(PICMDK_X86) && (defined(__GNUC__) || defined(__clang__))
+#define PICMDK_TARGET(isa) __attribute__((target(isa)))
+#else
+#define PICMDK_TARGET(isa)
+#endif
+
+
+namespace {
+
+using namespace picmdk::kernels;
+
+
+#ifdef PICMDK_X86
+
+InstructionSet detectInstructionSet()
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return SSE2;
+    return Scalar;
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    bool hasSSE2 = (info[3] & (1 << 26)) != 0;
+    bool hasOSXSave = (info[2] & (1 << 27)) != 0;
+    // AVX registers must also be saved by the operating system
+    unsigned long long xcr0 = hasOSXSave ? _xgetbv(0) : 0;
+    __cpuidex(info, 7, 0);
+    if (((info[1] & (1 << 16)) != 0) && ((xcr0 & 0xe6) == 0xe6))
+        return AVX512;
+    if (((info[1] & (1 << 5)) != 0) && ((xcr0 & 0x6) == 0x6))
+        return AVX2;
+    return hasSSE2 ? SSE2 : Scalar;
+#else
+    return Scalar;
+#endif
+}
+
+#else
+
+InstructionSet detectInstructionSet()
+{
+    return Scalar;
+}
+
+#endif
+
+
+const InstructionSet supportedInstructionSet = detectInstructionSet();
+InstructionSet currentInstructionSet = supportedInstructionSet;
+
+
+// Operations applied to tail elements which do not fill a vector register
+struct SumOp { template<typename T> static T apply(T a, T b) { return a + b; } };
+struct ProductOp { template<typename T> static T apply(T a, T b) { return a * b; } };
+struct MaxOp { template<typename T> static T apply(T a, T b) { return (a < b) ? b : a; } };
+struct MinOp { template<typename T> static T apply(T a, T b) { return (b < a) ? b : a; } };
+
+
+#ifdef PICMDK_X86
+
+// Define kernel name(dst, src, n) processing width elements of type T at a time.
+// Vector max and min return the second operand when either is NaN, so src goes first
+// to keep dst like the scalar versions: dst[i] = (dst[i] < src[i]) ? src[i] : dst[i]
+#define PICMDK_DEFINE_KERNEL(name, isa, T, width, load, store, vectorOp, Op) \
+    PICMDK_TARGET(isa) void name(T* dst, const T* src, int n) \
+    { \
+        int i = 0; \
+        for (; i + width <= n; i += width) \
+            store(dst + i, vectorOp(load(src + i), load(dst + i))); \
+        for (; i < n; i++) \
+            dst[i] = Op::apply(dst[i], src[i]); \
+    }
+
+#define PICMDK_LOAD_SI128(p) _mm_loadu_si128((const __m128i*)(p))
+#define PICMDK_STORE_SI128(p, v) _mm_storeu_si128((__m128i*)(p), v)
+#define PICMDK_LOAD_SI256(p) _mm256_loadu_si256((const __m256i*)(p))
+#define PICMDK_STORE_SI256(p, v) _mm256_storeu_si256((__m256i*)(p), v)
+#define PICMDK_LOAD_SI512(p) _mm512_loadu_si512((const void*)(p))
+#define PICMDK_STORE_SI512(p, v) _mm512_storeu_si512((void*)(p), v)
+
+// SSE2 has no integer min, max and 32-bit multiplication, scalar versions are used for them
+PICMDK_DEFINE_KERNEL(sumSSE2, "sse2", float, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_add_ps, SumOp)
+PICMDK_DEFINE_KERNEL(productSSE2, "sse2", float, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_mul_ps, ProductOp)
+PICMDK_DEFINE_KERNEL(maxSSE2, "sse2", float, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_max_ps, MaxOp)
+PICMDK_DEFINE_KERNEL(minSSE2, "sse2", float, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_min_ps, MinOp)
+PICMDK_DEFINE_KERNEL(sumSSE2, "sse2", double, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_add_pd, SumOp)
+PICMDK_DEFINE_KERNEL(productSSE2, "sse2", double, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_mul_pd, ProductOp)
+PICMDK_DEFINE_KERNEL(maxSSE2, "sse2", double, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_max_pd, MaxOp)
+PICMDK_DEFINE_KERNEL(minSSE2, "sse2", double, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_min_pd, MinOp)
+PICMDK_DEFINE_KERNEL(sumSSE2, "sse2", int, 4, PICMDK_LOAD_SI128, PICMDK_STORE_SI128, _mm_add_epi32, SumOp)
+
+PICMDK_DEFINE_KERNEL(sumAVX2, "avx2", float, 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_add_ps, SumOp)
+PICMDK_DEFINE_KERNEL(productAVX2, "avx2", float, 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_mul_ps, ProductOp)
+PICMDK_DEFINE_KERNEL(maxAVX2, "avx2", float, 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_max_ps, MaxOp)
+PICMDK_DEFINE_KERNEL(minAVX2, "avx2", float, 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_min_ps, MinOp)
+PICMDK_DEFINE_KERNEL(sumAVX2, "avx2", double, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_add_pd, SumOp)
+PICMDK_DEFINE_KERNEL(productAVX2, "avx2", double, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_mul_pd, ProductOp)
+PICMDK_DEFINE_KERNEL(maxAVX2, "avx2", double, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_max_pd, MaxOp)
+PICMDK_DEFINE_KERNEL(minAVX2, "avx2", double, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_min_pd, MinOp)
+PICMDK_DEFINE_KERNEL(sumAVX2, "avx2", int, 8, PICMDK_LOAD_SI256, PICMDK_STORE_SI256, _mm256_add_epi32, SumOp)
+PICMDK_DEFINE_KERNEL(productAVX2, "avx2", int, 8, PICMDK_LOAD_SI256, PICMDK_STORE_SI256, _mm256_mullo_epi32, ProductOp)
+PICMDK_DEFINE_KERNEL(maxAVX2, "avx2", int, 8, PICMDK_LOAD_SI256, PICMDK_STORE_SI256, _mm256_max_epi32, MaxOp)
+PICMDK_DEFINE_KERNEL(minAVX2, "avx2", int, 8, PICMDK_LOAD_SI256, PICMDK_STORE_SI256, _mm256_min_epi32, MinOp)
+
+PICMDK_DEFINE_KERNEL(sumAVX512, "avx512f", float, 16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_add_ps, SumOp)
+PICMDK_DEFINE_KERNEL(productAVX512, "avx512f", float, 16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_mul_ps, ProductOp)
+PICMDK_DEFINE_KERNEL(maxAVX512, "avx512f", float, 16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_max_ps, MaxOp)
+PICMDK_DEFINE_KERNEL(minAVX512, "avx512f", float, 16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_min_ps, MinOp)
+PICMDK_DEFINE_KERNEL(sumAVX512, "avx512f", double, 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_add_pd, SumOp)
+PICMDK_DEFINE_KERNEL(productAVX512, "avx512f", double, 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_mul_pd, ProductOp)
+PICMDK_DEFINE_KERNEL(maxAVX512, "avx512f", double, 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_max_pd, MaxOp)
+PICMDK_DEFINE_KERNEL(minAVX512, "avx512f", double, 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_min_pd, MinOp)
+PICMDK_DEFINE_KERNEL(sumAVX512, "avx512f", int, 16, PICMDK_LOAD_SI512, PICMDK_STORE_SI512, _mm512_add_epi32, SumOp)
+PICMDK_DEFINE_KERNEL(productAVX512, "avx512f", int, 16, PICMDK_LOAD_SI512, PICMDK_STORE_SI512, _mm512_mullo_epi32, ProductOp)
+PICMDK_DEFINE_KERNEL(maxAVX512, "avx512f", int, 16, PICMDK_LOAD_SI512, PICMDK_STORE_SI512, _mm512_max_epi32, MaxOp)
+PICMDK_DEFINE_KERNEL(minAVX512, "avx512f", int, 16, PICMDK_LOAD_SI512, PICMDK_STORE_SI512, _mm512_min_epi32, MinOp)
+
+#undef PICMDK_DEFINE_KERNEL
+
+// Call the kernel of the current instruction set, the scalar version if there is none
+#define PICMDK_DISPATCH_KERNEL(name) \
+    switch (currentInstructionSet) { \
+    case AVX512: name##AVX512(dst, src, n); return; \
+    case AVX2: name##AVX2(dst, src, n); return; \
+    case SSE2: name##SSE2(dst, src, n); return; \
+    default: name<T>(dst, src, n); return; \
+    }
+
+#define PICMDK_DISPATCH_KERNEL_NO_SSE2(name) \
+    switch (currentInstructionSet) { \
+    case AVX512: name##AVX512(dst, src, n); return; \
+    case AVX2: name##AVX2(dst, src, n); return; \
+    default: name<T>(dst, src, n); return; \
+    }
+
+#else
+
+#define PICMDK_DISPATCH_KERNEL(name) name<T>(dst, src, n);
+#define PICMDK_DISPATCH_KERNEL_NO_SSE2(name) name<T>(dst, src, n);
+
+#endif
+
+
+} // anonymous namespace
+
+
+namespace picmdk {
+namespace kernels {
+
+
+InstructionSet getInstructionSet()
+{
+    return currentInstructionSet;
+}
+
+void setInstructionSet(InstructionSet instructionSet)
+{
+    currentInstructionSet = (instructionSet < supportedInstructionSet) ? instructionSet : supportedInstructionSet;
+}
+
+const char* getInstructionSetName(InstructionSet instructionSet)
+{
+    switch (instructionSet) {
+    case SSE2: return "SSE2";
+    case AVX2: return "AVX2";
+    case AVX512: return "AVX-512";
+    default: return "scalar";
+    }
+}
+
+
+#define PICMDK_DEFINE_DISPATCH(name, Type, dispatch) \
+    void name(Type* dst, const Type* src, int n) \
+    { \
+        typedef Type T; \
+        dispatch(name) \
+    }
+
+PICMDK_DEFINE_DISPATCH(sum, float, PICMDK_DISPATCH_KERNEL)
+PICMDK_DEFINE_DISPATCH(sum, double, PICMDK_DISPATCH_KERNEL)
+PICMDK_DEFINE_DISPATCH(sum, int, PICMDK_DISPATCH_KERNEL)
+PICMDK_DEFINE_DISPATCH(product, float, PICMDK_DISPATCH_KERNEL)
+PICMDK_DEFINE_DISPATCH(product, double, PICMDK_DISPATCH_KERNEL)
+PICMDK_DEFINE_DISPATCH(product, int, PICMDK_DISPATCH_KERNEL_NO_SSE2)
+PICMDK_DEFINE_DISPATCH(max, float, PICMDK_DISPATCH_KERNEL)
+PICMDK_DEFINE_DISPATCH(max, double, PICMDK_DISPATCH_KERNEL)
+PICMDK_DEFINE_DISPATCH(max, int, PICMDK_DISPATCH_KERNEL_NO_SSE2)
+PICMDK_DEFINE_DISPATCH(min, float, PICMDK_DISPATCH_KERNEL)
+PICMDK_DEFINE_DISPATCH(min, double, PICMDK_DISPATCH_KERNEL)
+PICMDK_DEFINE_DISPATCH(min, int, PICMDK_DISPATCH_KERNEL_NO_SSE2)
+
+#undef PICMDK_DEFINE_DISPATCH
+
+
+} // namespace picmdk::kernels
+} // namespace picmdk
@@ -0,0 +1,314 @@
+#include "TestAdapter.h"
+#include "TestUtility.h"
+
+#include <stdexcept>
+
+using namespace picmdk;
+using namespace picmdk::test;
+
+typedef InterData::SynchronizationMode Mode;
+
+
+namespace {
+
+double unitEnergy(int threadIdx, int i)
+{
+    return 1.0;
+}
+
+// Registers datasets and throws in init() of the copy of the last thread
+class FailingParticleHandler : public ParticleHandler<TestController> {
+public:
+    virtual void init()
+    {
+        interData->registerExport(&exported, "partial", Mode(Mode::Sum, Mode::Global));
+        interData->registerImport(&imported, "unmatched");
+        if (omp_get_thread_num() == omp_get_num_threads() - 1)
+            throw std::invalid_argument("failing handler");
+    }
+    virtual void handle(Particle& particle, const Real3& E, const Real3& B)
+    {
+    }
+private:
+    InterData::Value<double> exported, imported;
+};
+
+class FailingModule : public ModuleImplementation<TestController, FailingParticleHandler> {
+public:
+    virtual std::string getName() const { return "failing"; }
+};
+
+// Exports the dataset of the failed handler with a different size
+class ArrayParticleHandler : public ParticleHandler<TestController> {
+public:
+    ArrayParticleHandler():
+        exported(3)
+    {
+    }
+    virtual void init()
+    {
+        interData->registerExport(&exported, "partial", Mode(Mode::Sum, Mode::Global));
+    }
+    virtual void handle(Particle& particle, const Real3& E, const Real3& B)
+    {
+        exported(particle.id % 3) += 1.0;
+    }
+private:
+    InterData::Array<double> exported;
+};
+
+class ArrayOutputHandler : public OutputHandler<TestController> {
+public:
+    static double sum;
+    ArrayOutputHandler():
+        imported(3)
+    {
+    }
+    virtual void init()
+    {
+        interData->registerImport(&imported, "partial");
+    }
+    virtual void handle()
+    {
+        sum = imported(0) + imported(1) + imported(2);
+    }
+private:
+    InterData::Array<double> imported;
+};
+
+double ArrayOutputHandler::sum = 0;
+
+class ArrayModule : public ModuleImplementation<TestController, ArrayParticleHandler, ArrayOutputHandler> {
+public:
+    virtual std::string getName() const { return "array"; }
+};
+
+// Counts handled particles, active on even iterations
+class EvenIterationParticleHandler : public ParticleHandler<TestController> {
+public:
+    static int numHandled;
+    virtual void init()
+    {
+        setSchedule(2);
+    }
+    virtual void handle(Particle& particle, const Real3& E, const Real3& B)
+    {
+        #pragma omp atomic
+        numHandled++;
+    }
+};
+
+int EvenIterationParticleHandler::numHandled = 0;
+
+class StaticModule : public StaticModuleImplementation<TestController, EvenIterationParticleHandler> {
+public:
+    virtual std::string getName() const { return "static"; }
+};
+
+// Counts particles and records the count of the previous synchronization seen by the particles
+class CountingParticleHandler : public ParticleHandler<TestController> {
+public:
+    static double seenCount;
+    virtual void init()
+    {
+        interData->registerExport(&count, "count", Mode(Mode::Sum, Mode::Global, Mode::Clear));
+        interData->registerImport(&previousCount, "count");
+    }
+    virtual void handle(Particle& particle, const Real3& E, const Real3& B)
+    {
+        count() += 1.0;
+        if (omp_get_thread_num() == 0)
+            seenCount = previousCount();
+    }
+private:
+    InterData::Value<double> count, previousCount;
+};
+
+double CountingParticleHandler::seenCount = 0;
+
+class CountingModule : public ModuleImplementation<TestController, CountingParticleHandler> {
+public:
+    virtual std::string getName() const { return "counting"; }
+};
+
+// Records the count seen when called for the IterationStart event
+class CountImportDomainHandler : public DomainHandler<TestController> {
+public:
+    static double seenCount;
+    virtual void init()
+    {
+        interData->registerImport(&count, "count");
+    }
+    virtual void handle(Ensemble& ensemble, Grid& grid)
+    {
+        seenCount = count();
+    }
+private:
+    InterData::Value<double> count;
+};
+
+double CountImportDomainHandler::seenCount = 0;
+
+class CountImportModule : public ModuleImplementation<TestController, CountImportDomainHandler> {
+public:
+    virtual std::string getName() const { return "countImport"; }
+};
+
+// Count their calls, active on even iterations
+class EvenIterationDomainHandler : public DomainHandler<TestController> {
+public:
+    static int numCalls;
+    virtual void init()
+    {
+        setSchedule(2);
+    }
+    virtual void handle(Ensemble& ensemble, Grid& grid)
+    {
+        numCalls++;
+    }
+};
+
+int EvenIterationDomainHandler::numCalls = 0;
+
+class EvenIterationDomainModule : public ModuleImplementation<TestController, EvenIterationDomainHandler> {
+public:
+    virtual std::string getName() const { return "evenIterationDomain"; }
+};
+
+class EvenIterationOutputHandler : public OutputHandler<TestController> {
+public:
+    static int numCalls;
+    virtual void init()
+    {
+        setSchedule(2);
+    }
+    virtual void handle()
+    {
+        numCalls++;
+    }
+};
+
+int EvenIterationOutputHandler::numCalls = 0;
+
+class EvenIterationOutputModule : public ModuleImplementation<TestController, EvenIterationOutputHandler> {
+public:
+    virtual std::string getName() const { return "evenIterationOutput"; }
+};
+
+} // anonymous namespace
+
+
+// In asynchronous mode imports of particle handlers are completed before the next loop over particles
+PICMDK_TEST(asynchronousImportsOfParticleHandlers)
+{
+    TestSimulation simulation;
+    TestController& controller = simulation.getController();
+    controller.setAsynchronousSynchronization(true);
+    simulation.addModule<CountingModule>();
+    controller.finalizeInit();
+    const int numParticles = 5;
+    double expected = (double)numParticles * omp_get_max_threads() * getNumProcesses();
+    for (int iteration = 1; iteration <= 3; iteration++) {
+        controller.startIteration(1.0);
+        simulation.runParticles(numParticles, unitEnergy);
+        PICMDK_CHECK_EQUAL((iteration > 1) ? expected : 0.0, CountingParticleHandler::seenCount);
+        controller.synchronizeInterData();
+    }
+}
+
+// Handler functions of events called outside of parallel regions wait for their imports
+PICMDK_TEST(asynchronousImportsOfEventHandlers)
+{
+    TestSimulation simulation;
+    TestController& controller = simulation.getController();
+    controller.setAsynchronousSynchronization(true);
+    simulation.addModule<CountingModule>();
+    simulation.addModule<CountImportModule>();
+    controller.finalizeInit();
+    const int numParticles = 5;
+    controller.startIteration(1.0);
+    simulation.runParticles(numParticles, unitEnergy);
+    controller.synchronizeInterData();
+    Ensemble ensemble;
+    Grid grid;
+    IterationStartEvent<TestController> event(ensemble, grid);
+    controller.handle(event);
+    PICMDK_CHECK_EQUAL((double)numParticles * omp_get_max_threads() * getNumProcesses(), CountImportDomainHandler::seenCount);
+}
+
+PICMDK_TEST(staticHandlersAreSkippedOnInactiveIterations)
+{
+    TestSimulation simulation;
+    TestController& controller = simulation.getController();
+    StaticModule& module = simulation.addModule<StaticModule>();
+    controller.finalizeInit();
+    EvenIterationParticleHandler::numHandled = 0;
+    const int numIterations = 5, numParticles = 10;
+    for (int iteration = 1; iteration <= numIterations; iteration++) {
+        controller.startIteration(1.0);
+        #pragma omp parallel
+        {
+            Particle particle;
+            particle.id = 0;
+            Vector3<double> E(0, 0, 0), B(0, 0, 0);
+            for (int i = 0; i < numParticles; i++)
+                module.runParticleHandlers(particle, E, B);
+        }
+    }
+    PICMDK_CHECK_EQUAL(numIterations / 2 * numParticles * omp_get_max_threads(), EvenIterationParticleHandler::numHandled);
+}
+
+PICMDK_TEST(domainHandlersAreSkippedOnInactiveIterations)
+{
+    TestSimulation simulation;
+    TestController& controller = simulation.getController();
+    simulation.addModule<EvenIterationDomainModule>();
+    controller.finalizeInit();
+    EvenIterationDomainHandler::numCalls = 0;
+    Ensemble ensemble;
+    Grid grid;
+    const int numIterations = 5;
+    for (int iteration = 1; iteration <= numIterations; iteration++) {
+        controller.startIteration(1.0);
+        controller.runDomainHandlers(ensemble, grid);
+        PICMDK_CHECK_EQUAL(iteration / 2, EvenIterationDomainHandler::numCalls);
+    }
+}
+
+PICMDK_TEST(outputHandlersAreSkippedOnInactiveIterations)
+{
+    TestSimulation simulation;
+    TestController& controller = simulation.getController();
+    simulation.addModule<EvenIterationOutputModule>();
+    controller.finalizeInit();
+    EvenIterationOutputHandler::numCalls = 0;
+    const int numIterations = 5;
+    for (int iteration = 1; iteration <= numIterations; iteration++) {
+        controller.startIteration(1.0);
+        controller.synchronizeInterData();
+        controller.runOutputHandlers();
+        PICMDK_CHECK_EQUAL(iteration / 2, EvenIterationOutputHandler::numCalls);
+    }
+}
+
+// The exception of a failed thread copy is rethrown with its type,
+// datasets of all copies are unregistered, so the controller stays usable
+PICMDK_TEST(failedThreadHandlerIsRemoved)
+{
+    TestSimulation simulation;
+    TestController& controller = simulation.getController();
+    PICMDK_CHECK_THROW(simulation.addModule<FailingModule>(), std::invalid_argument);
+    simulation.addModule<ArrayModule>();
+    controller.finalizeInit();
+    controller.startIteration(1.0);
+    simulation.runParticles(6, unitEnergy);
+    controller.synchronizeInterData();
+    controller.runOutputHandlers();
+    PICMDK_CHECK_EQUAL(6.0 * omp_get_max_threads() * getNumProcesses(), ArrayOutputHandler::sum);
+}
+
+
+int main(int argc, char** argv)
+{
+    return picmdk::test::runTests(argc, argv);
+}
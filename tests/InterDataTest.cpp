@@ -0,0 +1,735 @@
+#include "TestAdapter.h"
+#include "TestUtility.h"
+
+#include <limits>
+
+using namespace picmdk;
+using namespace picmdk::test;
+
+typedef InterData::SynchronizationMode Mode;
+
+
+namespace {
+
+// Each test exports a dataset from a particle handler and imports it to an output handler.
+// The dataset, its synchronization and the update for each particle are given by a Spec class with
+//   typedefs ExportType and ImportType of the datasets,
+//   static functions createExport() and createImport() to allocate the datasets with their sizes and values,
+//   static void registerExport(InterData&, ExportType&),
+//   static void update(ExportType&, const Particle&).
+
+template<class Spec>
+class ExportParticleHandler : public ParticleHandler<TestController> {
+public:
+    virtual void init()
+    {
+        dataSet.reset(Spec::createExport());
+        Spec::registerExport(*interData, *dataSet);
+    }
+    virtual void handle(Particle& particle, const Real3& E, const Real3& B)
+    {
+        Spec::update(*dataSet, particle);
+    }
+private:
+    std::auto_ptr<typename Spec::ExportType> dataSet;
+};
+
+template<class Spec>
+class ImportOutputHandler : public OutputHandler<TestController> {
+public:
+    static typename Spec::ImportType* imported;
+    static int numCalls;
+    virtual void init()
+    {
+        dataSet.reset(Spec::createImport());
+        interData->registerImport(dataSet.get(), Spec::name());
+        imported = dataSet.get();
+        numCalls = 0;
+    }
+    virtual void handle()
+    {
+        numCalls++;
+    }
+private:
+    std::auto_ptr<typename Spec::ImportType> dataSet;
+};
+
+template<class Spec>
+typename Spec::ImportType* ImportOutputHandler<Spec>::imported = 0;
+template<class Spec>
+int ImportOutputHandler<Spec>::numCalls = 0;
+
+template<class Spec>
+class TestModule : public ModuleImplementation<TestController, ExportParticleHandler<Spec>, ImportOutputHandler<Spec> > {
+public:
+    virtual std::string getName() const { return Spec::name(); }
+};
+
+template<class Spec>
+typename Spec::ImportType& getImport()
+{
+    return *ImportOutputHandler<Spec>::imported;
+}
+
+
+const int numParticles = 10;
+
+int getNumThreads()
+{
+    return omp_get_max_threads();
+}
+
+double energy(int threadIdx, int i)
+{
+    return 1.0 + threadIdx + 0.5 * i + 100.0 * getRank();
+}
+
+double energy(int rank, int threadIdx, int i)
+{
+    return 1.0 + threadIdx + 0.5 * i + 100.0 * rank;
+}
+
+// Sum of energies of particles of all threads of the given processes [beginRank, endRank)
+double getEnergySum(int beginRank, int endRank)
+{
+    double sum = 0;
+    for (int p = beginRank; p < endRank; p++)
+        for (int t = 0; t < getNumThreads(); t++)
+            for (int i = 0; i < numParticles; i++)
+                sum += energy(p, t, i);
+    return sum;
+}
+
+double getGlobalEnergySum()
+{
+    return getEnergySum(0, getNumProcesses());
+}
+
+// Start an iteration, run particle handlers and synchronize, then run output handlers
+void runIteration(TestSimulation& simulation, bool runParticles = true)
+{
+    TestController& controller = simulation.getController();
+    controller.startIteration(1.0);
+    if (runParticles)
+        simulation.runParticles(numParticles, (double(*)(int, int))energy);
+    controller.synchronizeInterData();
+    controller.runOutputHandlers();
+}
+
+// Imports are owned by handlers, so the simulation must outlive the checks
+template<class Spec>
+void runSingleModule(TestSimulation& simulation, int numIterations = 1)
+{
+    simulation.addModule<TestModule<Spec> >();
+    simulation.getController().finalizeInit();
+    for (int iteration = 0; iteration < numIterations; iteration++)
+        runIteration(simulation);
+}
+
+
+template<Mode::Operation operation, Mode::Locality locality, Mode::Finalization finalization>
+struct EnergySpec {
+    typedef InterData::Value<double> ExportType;
+    typedef InterData::Value<double> ImportType;
+    static const char* name() { return "energy"; }
+    static ExportType* createExport() { return new ExportType(); }
+    static ImportType* createImport() { return new ImportType(); }
+    static void registerExport(InterData& interData, ExportType& dataSet)
+    {
+        interData.registerExport(&dataSet, name(), Mode(operation, locality, finalization));
+    }
+    static void update(ExportType& dataSet, const Particle& particle)
+    {
+        if (operation == Mode::Max)
+            dataSet() = std::max(dataSet(), particle.energy);
+        else
+            dataSet() += particle.energy;
+    }
+};
+
+} // anonymous namespace
+
+
+PICMDK_TEST(globalSumOfThreadsAndProcesses)
+{
+    typedef EnergySpec<Mode::Sum, Mode::Global, Mode::Keep> Spec;
+    TestSimulation simulation;
+    runSingleModule<Spec>(simulation);
+    PICMDK_CHECK_CLOSE(getGlobalEnergySum(), getImport<Spec>()(), 1e-9);
+    PICMDK_CHECK_EQUAL(1, ImportOutputHandler<Spec>::numCalls);
+}
+
+PICMDK_TEST(localSumOfThreads)
+{
+    typedef EnergySpec<Mode::Sum, Mode::Local, Mode::Keep> Spec;
+    TestSimulation simulation;
+    runSingleModule<Spec>(simulation);
+    PICMDK_CHECK_CLOSE(getEnergySum(getRank(), getRank() + 1), getImport<Spec>()(), 1e-9);
+}
+
+PICMDK_TEST(keepFinalizationAccumulatesIterations)
+{
+    typedef EnergySpec<Mode::Sum, Mode::Global, Mode::Keep> Spec;
+    TestSimulation simulation;
+    runSingleModule<Spec>(simulation, 3);
+    PICMDK_CHECK_CLOSE(3 * getGlobalEnergySum(), getImport<Spec>()(), 1e-9);
+}
+
+PICMDK_TEST(clearFinalizationResetsCopies)
+{
+    typedef EnergySpec<Mode::Sum, Mode::Global, Mode::Clear> Spec;
+    TestSimulation simulation;
+    runSingleModule<Spec>(simulation, 3);
+    PICMDK_CHECK_CLOSE(getGlobalEnergySum(), getImport<Spec>()(), 1e-9);
+}
+
+PICMDK_TEST(globalMax)
+{
+    typedef EnergySpec<Mode::Max, Mode::Global, Mode::Clear> Spec;
+    TestSimulation simulation;
+    runSingleModule<Spec>(simulation);
+    PICMDK_CHECK_CLOSE(energy(getNumProcesses() - 1, getNumThreads() - 1, numParticles - 1), getImport<Spec>()(), 1e-9);
+}
+
+PICMDK_TEST(rootReceivesResult)
+{
+    struct Spec : EnergySpec<Mode::Sum, Mode::Root, Mode::Keep> {
+        static void registerExport(InterData& interData, ExportType& dataSet)
+        {
+            interData.registerExport(&dataSet, name(), Mode(Mode::Sum, Mode::Root).setRoot(getNumProcesses() - 1));
+        }
+    };
+    TestSimulation simulation;
+    runSingleModule<Spec>(simulation);
+    if (getRank() == getNumProcesses() - 1)
+        PICMDK_CHECK_CLOSE(getGlobalEnergySum(), getImport<Spec>()(), 1e-9);
+    else
+        PICMDK_CHECK_EQUAL(0.0, getImport<Spec>()());
+}
+
+
+namespace {
+
+// Element i of the array accumulates particles with id i, the array is large enough
+// for the thread-level stage to be done by several threads in chunks
+struct ArraySumSpec {
+    static const int size = 40000;
+    typedef InterData::Array<double> ExportType;
+    typedef InterData::Array<double> ImportType;
+    static const char* name() { return "arraySum"; }
+    static ExportType* createExport() { return new ExportType(size); }
+    static ImportType* createImport() { return new ImportType(size); }
+    static void registerExport(InterData& interData, ExportType& dataSet)
+    {
+        interData.registerExport(&dataSet, name(), Mode(Mode::Sum, Mode::Global, Mode::Clear));
+    }
+    static void update(ExportType& dataSet, const Particle& particle)
+    {
+        for (int i = particle.id; i < size; i += numParticles)
+            dataSet(i) += particle.energy;
+    }
+};
+
+void checkArraySum(const InterData::Array<double>& result)
+{
+    bool isCorrect = (result.getSize() == ArraySumSpec::size);
+    for (int i = 0; isCorrect && (i < result.getSize()); i++) {
+        double expected = 0;
+        for (int p = 0; p < getNumProcesses(); p++)
+            for (int t = 0; t < getNumThreads(); t++)
+                expected += energy(p, t, i % numParticles);
+        isCorrect = std::fabs(result(i) - expected) < 1e-9;
+    }
+    PICMDK_CHECK(isCorrect);
+}
+
+} // anonymous namespace
+
+
+PICMDK_TEST(chunkedReductionOfLargeArray)
+{
+    TestSimulation simulation;
+    runSingleModule<ArraySumSpec>(simulation, 2);
+    checkArraySum(getImport<ArraySumSpec>());
+}
+
+PICMDK_TEST(nodeReduction)
+{
+    TestSimulation simulation;
+    simulation.getController().setInterDataNodeReduction(true);
+    simulation.addModule<TestModule<ArraySumSpec> >();
+    simulation.getController().finalizeInit();
+    runIteration(simulation);
+    runIteration(simulation);
+    checkArraySum(getImport<ArraySumSpec>());
+}
+
+PICMDK_TEST(asynchronousSynchronization)
+{
+    for (int doubleBuffering = 0; doubleBuffering < 2; doubleBuffering++) {
+        TestSimulation simulation;
+        TestController& controller = simulation.getController();
+        controller.setAsynchronousSynchronization(true);
+        controller.setInterDataDoubleBuffering(doubleBuffering != 0);
+        simulation.addModule<TestModule<ArraySumSpec> >();
+        controller.finalizeInit();
+        runIteration(simulation);
+        checkArraySum(getImport<ArraySumSpec>());
+        runIteration(simulation);
+        checkArraySum(getImport<ArraySumSpec>());
+    }
+}
+
+
+namespace {
+
+// Thread t of process p exports t + 1 elements equal to 100 * p + t
+template<Mode::Operation operation>
+struct GatherSpec {
+    typedef InterData::Array<int> ExportType;
+    typedef InterData::Array<int> ImportType;
+    static const char* name() { return "gather"; }
+    static ExportType* createExport() { return new ExportType(); }
+    static ImportType* createImport() { return new ImportType(); }
+    static void registerExport(InterData& interData, ExportType& dataSet)
+    {
+        interData.registerExport(&dataSet, name(), Mode(operation, Mode::Global, Mode::Clear));
+    }
+    static void update(ExportType& dataSet, const Particle& particle)
+    {
+        int threadIdx = (int)particle.position.x;
+        if (particle.id)
+            return;
+        dataSet.resize(threadIdx + 1);
+        for (int i = 0; i < dataSet.getSize(); i++)
+            dataSet(i) = 100 * getRank() + threadIdx;
+    }
+};
+
+void checkGather(const InterData::Array<int>& result)
+{
+    std::vector<int> expected;
+    for (int p = 0; p < getNumProcesses(); p++)
+        for (int t = 0; t < getNumThreads(); t++)
+            expected.insert(expected.end(), t + 1, 100 * p + t);
+    bool isCorrect = (result.getSize() == (int)expected.size());
+    for (int i = 0; isCorrect && (i < result.getSize()); i++)
+        isCorrect = (result(i) == expected[i]);
+    PICMDK_CHECK(isCorrect);
+}
+
+// Each thread appends ids of its particles
+struct ParticleListSpec {
+    typedef InterData::ParticleList<int> ExportType;
+    typedef InterData::Array<int> ImportType;
+    static const char* name() { return "particleList"; }
+    static ExportType* createExport() { return new ExportType(); }
+    static ImportType* createImport() { return new ImportType(); }
+    static void registerExport(InterData& interData, ExportType& dataSet)
+    {
+        interData.registerExport(&dataSet, name(), Mode(Mode::AllGather, Mode::Global, Mode::Clear));
+    }
+    static void update(ExportType& dataSet, const Particle& particle)
+    {
+        dataSet.append(particle.id);
+    }
+};
+
+} // anonymous namespace
+
+
+PICMDK_TEST(gatherToRoot)
+{
+    typedef GatherSpec<Mode::Gather> Spec;
+    TestSimulation simulation;
+    runSingleModule<Spec>(simulation, 2);
+    if (getRank() == 0)
+        checkGather(getImport<Spec>());
+    else
+        PICMDK_CHECK_EQUAL(0, getImport<Spec>().getSize());
+}
+
+PICMDK_TEST(allGather)
+{
+    typedef GatherSpec<Mode::AllGather> Spec;
+    TestSimulation simulation;
+    runSingleModule<Spec>(simulation, 2);
+    checkGather(getImport<Spec>());
+}
+
+PICMDK_TEST(particleListAllGather)
+{
+    TestSimulation simulation;
+    runSingleModule<ParticleListSpec>(simulation, 2);
+    const InterData::Array<int>& result = getImport<ParticleListSpec>();
+    bool isCorrect = (result.getSize() == getNumProcesses() * getNumThreads() * numParticles);
+    for (int i = 0; isCorrect && (i < result.getSize()); i++)
+        isCorrect = (result(i) == i % numParticles);
+    PICMDK_CHECK(isCorrect);
+}
+
+
+namespace {
+
+// Row r of the matrix accumulates the number of particles with id % numRows == r
+struct ReduceScatterSpec {
+    static const int numRows = 5, numCols = 3;
+    typedef InterData::Array2d<double> ExportType;
+    typedef InterData::Array2d<double> ImportType;
+    static const char* name() { return "reduceScatter"; }
+    static ExportType* createExport() { return new ExportType(numRows, numCols); }
+    static ImportType* createImport() { return new ImportType(numRows, numCols); }
+    static void registerExport(InterData& interData, ExportType& dataSet)
+    {
+        interData.registerExport(&dataSet, name(), Mode(Mode::Sum, Mode::ReduceScatter, Mode::Clear));
+    }
+    static void update(ExportType& dataSet, const Particle& particle)
+    {
+        for (int j = 0; j < numCols; j++)
+            dataSet(particle.id % numRows, j) += 1.0;
+    }
+};
+
+} // anonymous namespace
+
+
+PICMDK_TEST(reduceScatter)
+{
+    typedef ReduceScatterSpec Spec;
+    TestSimulation simulation;
+    simulation.addModule<TestModule<Spec> >();
+    simulation.getController().finalizeInit();
+    runIteration(simulation);
+    // Slabs are [p * n / P, (p + 1) * n / P) of the rows
+    int numProcesses = getNumProcesses(), rank = getRank();
+    int expectedBegin = Spec::numRows * rank / numProcesses, expectedEnd = Spec::numRows * (rank + 1) / numProcesses;
+    const InterData::Array2d<double>& result = getImport<Spec>();
+    for (int i = 0; i < Spec::numRows; i++)
+        for (int j = 0; j < Spec::numCols; j++) {
+            bool isInSlab = (i >= expectedBegin) && (i < expectedEnd);
+            double expected = isInSlab ? (double)(numParticles / Spec::numRows) * getNumThreads() * numProcesses : 0.0;
+            PICMDK_CHECK_EQUAL(expected, result(i, j));
+        }
+}
+
+
+namespace {
+
+// User-defined reduction of the range and number of energies
+struct EnergyRange {
+    double min, max;
+    int count;
+};
+
+struct MergeEnergyRange {
+    void operator()(EnergyRange& destination, const EnergyRange& source) const
+    {
+        destination.min = std::min(destination.min, source.min);
+        destination.max = std::max(destination.max, source.max);
+        destination.count += source.count;
+    }
+};
+
+struct CustomSpec {
+    typedef InterData::Value<EnergyRange> ExportType;
+    typedef InterData::Value<EnergyRange> ImportType;
+    static const char* name() { return "custom"; }
+    static ExportType* createExport()
+    {
+        EnergyRange empty = { std::numeric_limits<double>::max(), -std::numeric_limits<double>::max(), 0 };
+        return new ExportType(empty);
+    }
+    static ImportType* createImport() { return new ImportType(); }
+    static void registerExport(InterData& interData, ExportType& dataSet)
+    {
+        interData.registerCustomExport<MergeEnergyRange>(&dataSet, name(), Mode(Mode::Custom, Mode::Global));
+    }
+    static void update(ExportType& dataSet, const Particle& particle)
+    {
+        EnergyRange range = { particle.energy, particle.energy, 1 };
+        MergeEnergyRange()(dataSet(), range);
+    }
+};
+
+} // anonymous namespace
+
+
+PICMDK_TEST(customReduction)
+{
+    TestSimulation simulation;
+    runSingleModule<CustomSpec>(simulation);
+    const EnergyRange& result = getImport<CustomSpec>()();
+    PICMDK_CHECK_EQUAL(energy(0, 0, 0), result.min);
+    PICMDK_CHECK_EQUAL(energy(getNumProcesses() - 1, getNumThreads() - 1, numParticles - 1), result.max);
+    PICMDK_CHECK_EQUAL(getNumProcesses() * getNumThreads() * numParticles, result.count);
+}
+
+PICMDK_TEST(customReductionOfSharedCopyThrows)
+{
+    struct Spec : CustomSpec {
+        static void registerExport(InterData& interData, ExportType& dataSet)
+        {
+            interData.registerCustomExport<MergeEnergyRange>(&dataSet, name(), Mode(Mode::Custom, Mode::Global, Mode::Keep, Mode::Shared));
+        }
+    };
+    TestSimulation simulation;
+    PICMDK_CHECK_THROW(simulation.addModule<TestModule<Spec> >(), InterData::SynchronizationException);
+}
+
+
+namespace {
+
+struct PeriodSpec : EnergySpec<Mode::Sum, Mode::Global, Mode::Clear> {
+    static const char* name() { return "period"; }
+    static void registerExport(InterData& interData, ExportType& dataSet)
+    {
+        interData.registerExport(&dataSet, name(), Mode(Mode::Sum, Mode::Global, Mode::Clear).setPeriod(2));
+    }
+};
+
+struct OutputEventSpec : EnergySpec<Mode::Sum, Mode::Global, Mode::Clear> {
+    static const char* name() { return "outputEvent"; }
+    static void registerExport(InterData& interData, ExportType& dataSet)
+    {
+        interData.registerExport(&dataSet, name(), Mode(Mode::Sum, Mode::Global, Mode::Clear).bindToEvent(Event::Output));
+    }
+};
+
+} // anonymous namespace
+
+
+PICMDK_TEST(synchronizationPeriod)
+{
+    TestSimulation simulation;
+    simulation.addModule<TestModule<PeriodSpec> >();
+    simulation.getController().finalizeInit();
+    runIteration(simulation);
+    PICMDK_CHECK_EQUAL(0.0, getImport<PeriodSpec>()());
+    runIteration(simulation);
+    PICMDK_CHECK_CLOSE(2 * getGlobalEnergySum(), getImport<PeriodSpec>()(), 1e-9);
+}
+
+PICMDK_TEST(synchronizationBoundToEvent)
+{
+    TestSimulation simulation;
+    TestController& controller = simulation.getController();
+    simulation.addModule<TestModule<OutputEventSpec> >();
+    controller.finalizeInit();
+    controller.startIteration(1.0);
+    simulation.runParticles(numParticles, (double(*)(int, int))energy);
+    controller.synchronizeInterData();
+    PICMDK_CHECK_EQUAL(0.0, getImport<OutputEventSpec>()());
+    controller.runOutputHandlers();
+    PICMDK_CHECK_CLOSE(getGlobalEnergySum(), getImport<OutputEventSpec>()(), 1e-9);
+}
+
+PICMDK_TEST(dirtyTrackingSkipsUnchangedDatasets)
+{
+    typedef EnergySpec<Mode::Sum, Mode::Global, Mode::Keep> Spec;
+    TestSimulation simulation;
+    simulation.getController().setInterDataDirtyTracking(true);
+    simulation.addModule<TestModule<Spec> >();
+    simulation.getController().finalizeInit();
+    runIteration(simulation);
+    PICMDK_CHECK_CLOSE(getGlobalEnergySum(), getImport<Spec>()(), 1e-9);
+    // Without modified copies the synchronization is skipped, so the import is not overwritten
+    getImport<Spec>()() = -1.0;
+    runIteration(simulation, false);
+    PICMDK_CHECK_EQUAL(-1.0, getImport<Spec>()());
+    runIteration(simulation);
+    PICMDK_CHECK_CLOSE(2 * getGlobalEnergySum(), getImport<Spec>()(), 1e-9);
+}
+
+
+namespace {
+
+// All threads update the same copy
+struct SharedSpec : EnergySpec<Mode::Sum, Mode::Local, Mode::Clear> {
+    static const char* name() { return "shared"; }
+    static void registerExport(InterData& interData, ExportType& dataSet)
+    {
+        interData.registerExport(&dataSet, name(), Mode(Mode::Sum, Mode::Local, Mode::Clear, Mode::Shared));
+    }
+    static void update(ExportType& dataSet, const Particle& particle)
+    {
+        InterData::atomicAdd(dataSet(), particle.energy);
+    }
+};
+
+// Each thread touches a few elements of a large array with lazily allocated pages
+struct LazySpec {
+    static const int size = 1 << 20;
+    typedef InterData::Array<double> ExportType;
+    typedef InterData::Array<double> ImportType;
+    static const char* name() { return "lazy"; }
+    static ExportType* createExport() { return new ExportType(size); }
+    static ImportType* createImport() { return new ImportType(size); }
+    static void registerExport(InterData& interData, ExportType& dataSet)
+    {
+        interData.registerExport(&dataSet, name(), Mode(Mode::Sum, Mode::Local, Mode::Clear, Mode::LazyPrivate));
+    }
+    static void update(ExportType& dataSet, const Particle& particle)
+    {
+        dataSet((int)particle.position.x * 65536 + particle.id) += particle.energy;
+    }
+};
+
+} // anonymous namespace
+
+
+PICMDK_TEST(sharedCopyWithAtomicUpdates)
+{
+    TestSimulation simulation;
+    runSingleModule<SharedSpec>(simulation, 2);
+    PICMDK_CHECK_CLOSE(getEnergySum(getRank(), getRank() + 1), getImport<SharedSpec>()(), 1e-9);
+}
+
+PICMDK_TEST(lazilyAllocatedCopies)
+{
+    TestSimulation simulation;
+    runSingleModule<LazySpec>(simulation, 2);
+    const InterData::Array<double>& result = getImport<LazySpec>();
+    bool isCorrect = true;
+    double sum = 0;
+    for (int i = 0; i < result.getSize(); i++)
+        sum += result(i);
+    for (int t = 0; t < getNumThreads(); t++)
+        for (int i = 0; i < numParticles; i++)
+            isCorrect = isCorrect && (std::fabs(result(t * 65536 + i) - energy(t, i)) < 1e-9);
+    PICMDK_CHECK(isCorrect);
+    PICMDK_CHECK_CLOSE(getEnergySum(getRank(), getRank() + 1), sum, 1e-9);
+}
+
+
+namespace {
+
+// Each thread adds 1 to all cells including ghost cells
+struct HaloSpec {
+    typedef InterData::DomainArray3d<double> ExportType;
+    typedef InterData::DomainArray3d<double> ImportType;
+    static const char* name() { return "halo"; }
+    static ExportType* createExport() { return new ExportType(Vector3<int>(4, 3, 2), 1); }
+    static ImportType* createImport() { return new ImportType(Vector3<int>(4, 3, 2), 1); }
+    static void registerExport(InterData& interData, ExportType& dataSet)
+    {
+        interData.registerExport(&dataSet, name(), Mode(Mode::Sum, Mode::Halo, Mode::Clear));
+    }
+    static void update(ExportType& dataSet, const Particle& particle)
+    {
+        if (particle.id)
+            return;
+        for (int i = -1; i <= 4; i++)
+            for (int j = -1; j <= 3; j++)
+                for (int k = -1; k <= 2; k++)
+                    dataSet(i, j, k) += 1.0;
+    }
+};
+
+} // anonymous namespace
+
+
+// With periodic boundaries each cell gets the values of its ghost images,
+// a cell at the boundary along d cells has 2^d images, then ghost cells get the values of their images
+PICMDK_TEST(haloExchangeWithPeriodicDomains)
+{
+    TestSimulation simulation;
+    TestController& controller = simulation.getController();
+    controller.setDomainDecomposition(Vector3<int>(getNumProcesses(), 1, 1), Vector3<int>(1, 1, 1));
+    simulation.addModule<TestModule<HaloSpec> >();
+    controller.finalizeInit();
+    runIteration(simulation);
+    const InterData::DomainArray3d<double>& result = getImport<HaloSpec>();
+    Vector3<int> numCells = result.getNumCells();
+    bool isCorrect = true;
+    for (int i = -1; i <= numCells.x; i++)
+        for (int j = -1; j <= numCells.y; j++)
+            for (int k = -1; k <= numCells.z; k++) {
+                Vector3<int> cell((i + numCells.x) % numCells.x, (j + numCells.y) % numCells.y, (k + numCells.z) % numCells.z);
+                double expected = getNumThreads();
+                for (int d = 0; d < 3; d++)
+                    if ((cell[d] == 0) || (cell[d] == numCells[d] - 1))
+                        expected *= 2;
+                isCorrect = isCorrect && (result(i, j, k) == expected);
+            }
+    PICMDK_CHECK(isCorrect);
+}
+
+namespace {
+
+// Keys of all particles have the given sign, so a key 0 of an initial or cleared copy would win
+template<Mode::Operation operation, int sign>
+struct KeyPayloadSpec {
+    typedef InterData::KeyPayload<double, int> Element;
+    typedef InterData::Value<Element> ExportType;
+    typedef InterData::Value<Element> ImportType;
+    static const char* name() { return "keyPayload"; }
+    static ExportType* createExport() { return new ExportType(); }
+    static ImportType* createImport() { return new ImportType(); }
+    static void registerExport(InterData& interData, ExportType& dataSet)
+    {
+        interData.registerExport(&dataSet, name(), Mode(operation, Mode::Global, Mode::Clear));
+    }
+    static void update(ExportType& dataSet, const Particle& particle)
+    {
+        Element element(sign * particle.energy, 1000 * getRank() + 100 * (int)particle.position.x + particle.id);
+        bool isBetter = (operation == Mode::MaxLoc) ? (element.key > dataSet().key) : (element.key < dataSet().key);
+        if (isBetter)
+            dataSet() = element;
+    }
+};
+
+// All particles have the same key, so the smallest payload is taken
+struct EqualKeysSpec : KeyPayloadSpec<Mode::MaxLoc, 1> {
+    static void update(ExportType& dataSet, const Particle& particle)
+    {
+        Element element(1.0, 1000 * getRank() + 100 * (int)particle.position.x + particle.id);
+        if ((element.key > dataSet().key) || ((element.key == dataSet().key) && (element.payload < dataSet().payload)))
+            dataSet() = element;
+    }
+};
+
+} // anonymous namespace
+
+
+PICMDK_TEST(minLocOfPositiveKeys)
+{
+    typedef KeyPayloadSpec<Mode::MinLoc, 1> Spec;
+    TestSimulation simulation;
+    runSingleModule<Spec>(simulation, 2);
+    PICMDK_CHECK_EQUAL(energy(0, 0, 0), getImport<Spec>()().key);
+    PICMDK_CHECK_EQUAL(0, getImport<Spec>()().payload);
+}
+
+PICMDK_TEST(maxLocOfNegativeKeys)
+{
+    typedef KeyPayloadSpec<Mode::MaxLoc, -1> Spec;
+    TestSimulation simulation;
+    runSingleModule<Spec>(simulation, 2);
+    PICMDK_CHECK_EQUAL(-energy(0, 0, 0), getImport<Spec>()().key);
+    PICMDK_CHECK_EQUAL(0, getImport<Spec>()().payload);
+}
+
+PICMDK_TEST(maxLocOfEqualKeysTakesSmallestPayload)
+{
+    TestSimulation simulation;
+    runSingleModule<EqualKeysSpec>(simulation, 2);
+    PICMDK_CHECK_EQUAL(1.0, getImport<EqualKeysSpec>()().key);
+    PICMDK_CHECK_EQUAL(0, getImport<EqualKeysSpec>()().payload);
+}
+
+PICMDK_TEST(mismatchedImportThrows)
+{
+    struct Spec : EnergySpec<Mode::Sum, Mode::Global, Mode::Keep> {
+        typedef InterData::Array<double> ImportType;
+        static ImportType* createImport() { return new ImportType(2); }
+    };
+    TestSimulation simulation;
+    simulation.addModule<TestModule<Spec> >();
+    PICMDK_CHECK_THROW(simulation.getController().finalizeInit(), InterData::SynchronizationException);
+}
+
+
+int main(int argc, char** argv)
+{
+    return picmdk::test::runTests(argc, argv);
+}
@@ -0,0 +1,121 @@
+#include "ReductionKernels.h"
+#include "TestUtility.h"
+
+#include <cstring>
+#include <limits>
+#include <vector>
+
+using namespace picmdk;
+using namespace picmdk::test;
+
+
+namespace {
+
+typedef void (*FloatKernel)(float*, const float*, int);
+typedef void (*DoubleKernel)(double*, const double*, int);
+typedef void (*IntKernel)(int*, const int*, int);
+
+// Deterministic values with both signs, some of them equal
+template<typename T>
+std::vector<T> createValues(int n, unsigned int seed)
+{
+    std::vector<T> values(n);
+    for (int i = 0; i < n; i++) {
+        seed = seed * 1103515245u + 12345u;
+        values[i] = (T)((int)((seed >> 16) % 19) - 9) / (T)2;
+    }
+    return values;
+}
+
+// NaNs in every third element of dst and every fifth of src, so that all combinations occur
+template<typename T>
+void insertNaNs(std::vector<T>& dst, std::vector<T>& src)
+{
+    for (size_t i = 0; i < dst.size(); i += 3)
+        dst[i] = std::numeric_limits<T>::quiet_NaN();
+    for (size_t i = 1; i < src.size(); i += 5)
+        src[i] = std::numeric_limits<T>::quiet_NaN();
+}
+
+template<typename T>
+bool isSame(T a, T b)
+{
+    if ((a != a) || (b != b))
+        return (a != a) && (b != b);
+    return std::memcmp(&a, &b, sizeof(T)) == 0;
+}
+
+// Compare the kernel of each instruction set with the generic scalar version
+// for sizes covering full vectors and tails
+template<typename T>
+void checkKernel(void (*kernel)(T*, const T*, int), void (*scalarKernel)(T*, const T*, int),
+    bool withNaNs, const std::string& name)
+{
+    const kernels::InstructionSet instructionSets[] = { kernels::Scalar, kernels::SSE2, kernels::AVX2, kernels::AVX512 };
+    const int sizes[] = { 0, 1, 3, 4, 7, 8, 15, 16, 17, 33, 1000 };
+    for (int s = 0; s < 4; s++) {
+        kernels::setInstructionSet(instructionSets[s]);
+        for (int k = 0; k < (int)(sizeof(sizes) / sizeof(sizes[0])); k++) {
+            int n = sizes[k];
+            std::vector<T> dst = createValues<T>(n, 1), src = createValues<T>(n, 2);
+            if (withNaNs)
+                insertNaNs(dst, src);
+            std::vector<T> expected = dst;
+            if (n) {
+                scalarKernel(&expected[0], &src[0], n);
+                kernel(&dst[0], &src[0], n);
+            }
+            bool isCorrect = true;
+            for (int i = 0; i < n; i++)
+                isCorrect = isCorrect && isSame(expected[i], dst[i]);
+            if (!isCorrect)
+                reportFailure(name + " differs from the scalar version for " + toString(n) + " elements with " +
+                    kernels::getInstructionSetName(kernels::getInstructionSet()), __FILE__, __LINE__);
+        }
+    }
+    kernels::setInstructionSet(kernels::AVX512);
+}
+
+} // anonymous namespace
+
+
+PICMDK_TEST(floatKernelsMatchScalarVersions)
+{
+    checkKernel<float>((FloatKernel)kernels::sum, kernels::sum<float>, false, "sum");
+    checkKernel<float>((FloatKernel)kernels::product, kernels::product<float>, false, "product");
+    checkKernel<float>((FloatKernel)kernels::max, kernels::max<float>, false, "max");
+    checkKernel<float>((FloatKernel)kernels::min, kernels::min<float>, false, "min");
+}
+
+PICMDK_TEST(doubleKernelsMatchScalarVersions)
+{
+    checkKernel<double>((DoubleKernel)kernels::sum, kernels::sum<double>, false, "sum");
+    checkKernel<double>((DoubleKernel)kernels::product, kernels::product<double>, false, "product");
+    checkKernel<double>((DoubleKernel)kernels::max, kernels::max<double>, false, "max");
+    checkKernel<double>((DoubleKernel)kernels::min, kernels::min<double>, false, "min");
+}
+
+PICMDK_TEST(intKernelsMatchScalarVersions)
+{
+    checkKernel<int>((IntKernel)kernels::sum, kernels::sum<int>, false, "sum");
+    checkKernel<int>((IntKernel)kernels::product, kernels::product<int>, false, "product");
+    checkKernel<int>((IntKernel)kernels::max, kernels::max<int>, false, "max");
+    checkKernel<int>((IntKernel)kernels::min, kernels::min<int>, false, "min");
+}
+
+// The scalar max and min keep dst when either element is NaN, vector versions must do the same
+PICMDK_TEST(maxAndMinWithNaNsMatchScalarVersions)
+{
+    checkKernel<float>((FloatKernel)kernels::max, kernels::max<float>, true, "max");
+    checkKernel<float>((FloatKernel)kernels::min, kernels::min<float>, true, "min");
+    checkKernel<double>((DoubleKernel)kernels::max, kernels::max<double>, true, "max");
+    checkKernel<double>((DoubleKernel)kernels::min, kernels::min<double>, true, "min");
+    checkKernel<float>((FloatKernel)kernels::sum, kernels::sum<float>, true, "sum");
+    checkKernel<double>((DoubleKernel)kernels::product, kernels::product<double>, true, "product");
+}
+
+
+int main(int argc, char** argv)
+{
+    return picmdk::test::runTests(argc, argv);
+}
@@ -0,0 +1,121 @@
+#ifndef PICMDK_TESTADAPTER_H
+#define PICMDK_TESTADAPTER_H
+
+
+#include "Communicator.h"
+#include "Controller.h"
+#include "Module.h"
+#include "TestUtility.h"
+#include "Vector.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+
+namespace picmdk {
+namespace test {
+
+
+// Adapter with minimal particles and cells, tests run the loops over them explicitly
+struct Particle {
+    double energy;
+    Vector3<double> position;
+    int id;
+};
+
+struct Cell {
+    int index;
+    double value;
+};
+
+struct Grid {
+    typedef Cell* CellIterator;
+};
+
+struct Ensemble {
+    typedef Particle* ParticleIterator;
+};
+
+struct Input {
+};
+
+class Adapter {
+public:
+    typedef double Real;
+    typedef Vector3<double> Real3;
+    typedef Vector3<double> Position;
+    typedef test::Particle Particle;
+    typedef test::Cell Cell;
+    typedef test::Ensemble Ensemble;
+    typedef test::Grid Grid;
+    typedef test::Input Input;
+};
+
+typedef Controller<Adapter> TestController;
+
+
+// Controller over MPI_COMM_WORLD with the given modules added
+class TestSimulation {
+public:
+
+    TestSimulation():
+        communicator(Communicator::create()),
+        controller(TestController::Data(), communicator.get(), Input())
+    {
+    }
+
+    template<class Module>
+    Module& addModule()
+    {
+        Module* module = new Module;
+        modules.push_back(module);
+        module->setInstanceName("test");
+        controller.addModule(*module);
+        return *module;
+    }
+
+    ~TestSimulation()
+    {
+        for (size_t i = 0; i < modules.size(); i++)
+            delete modules[i];
+    }
+
+    TestController& getController()
+    {
+        return controller;
+    }
+
+    // Run particle handlers for the given number of particles per thread,
+    // particle i of thread t has energy value(t, i) and id i
+    template<class Value>
+    void runParticles(int numParticlesPerThread, Value value)
+    {
+        Vector3<double> E(0, 0, 0), B(0, 0, 0);
+        #pragma omp parallel
+        {
+            int threadIdx = omp_get_thread_num();
+            for (int i = 0; i < numParticlesPerThread; i++) {
+                Particle particle;
+                particle.energy = value(threadIdx, i);
+                particle.position = Vector3<double>(threadIdx, i, getRank());
+                particle.id = i;
+                controller.runParticleHandlers(particle, E, B);
+            }
+        }
+    }
+
+private:
+
+    std::auto_ptr<Communicator> communicator;
+    TestController controller;
+    std::vector<Module<TestController>*> modules;
+
+};
+
+
+} // namespace picmdk::test
+} // namespace picmdk
+
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef PICMDK_TESTUTILITY_H
+#define PICMDK_TESTUTILITY_H
+
+
+#include "Exception.h"
+#include "MPIWrapper.h"
+#include "Utility.h"
+
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+// Minimal test framework: tests are functions declared with PICMDK_TEST and run by runTests(),
+// failed checks are reported and the test continues
+namespace picmdk {
+namespace test {
+
+
+typedef void (*TestFunction)();
+
+struct TestDescription {
+    std::string name;
+    TestFunction function;
+};
+
+inline std::vector<TestDescription>& getTests()
+{
+    static std::vector<TestDescription> tests;
+    return tests;
+}
+
+inline int& getNumFailures()
+{
+    static int numFailures = 0;
+    return numFailures;
+}
+
+inline int getRank()
+{
+    int rank = 0;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    return rank;
+}
+
+inline int getNumProcesses()
+{
+    int numProcesses = 1;
+    MPI_Comm_size(MPI_COMM_WORLD, &numProcesses);
+    return numProcesses;
+}
+
+class TestRegistration {
+public:
+    TestRegistration(const std::string& name, TestFunction function)
+    {
+        TestDescription test;
+        test.name = name;
+        test.function = function;
+        getTests().push_back(test);
+    }
+};
+
+inline void reportFailure(const std::string& message, const char* file, int line)
+{
+    getNumFailures()++;
+    std::cerr << file << ":" << line << ": check failed at process " << getRank() << ": " << message << "\n";
+}
+
+// Run all tests, return the exit code: 0 in case all passed on all processes
+inline int runTests(int argc, char** argv)
+{
+#ifdef PICMDK_USE_MPI
+    MPI_Init(&argc, &argv);
+#endif
+    std::vector<TestDescription>& tests = getTests();
+    for (size_t i = 0; i < tests.size(); i++) {
+        int numFailures = getNumFailures();
+        try {
+            tests[i].function();
+        }
+        catch (Exception& e) {
+            std::cerr << e;
+            getNumFailures()++;
+        }
+        catch (std::exception& e) {
+            std::cerr << "exception: " << e.what() << "\n";
+            getNumFailures()++;
+        }
+        if (getRank() == 0)
+            std::cout << ((getNumFailures() == numFailures) ? "[  OK  ] " : "[FAILED] ") << tests[i].name << "\n";
+    }
+    int numFailures = getNumFailures();
+#ifdef PICMDK_USE_MPI
+    int totalNumFailures = 0;
+    MPI_Allreduce(&numFailures, &totalNumFailures, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    numFailures = totalNumFailures;
+    MPI_Finalize();
+#endif
+    return numFailures ? 1 : 0;
+}
+
+
+} // namespace picmdk::test
+} // namespace picmdk
+
+
+#define PICMDK_TEST(name) \
+    void name(); \
+    ::picmdk::test::TestRegistration name##Registration(#name, &name); \
+    void name()
+
+#define PICMDK_CHECK(condition) \
+    do { \
+        if (!(condition)) \
+            ::picmdk::test::reportFailure(#condition, __FILE__, __LINE__); \
+    } while (0)
+
+#define PICMDK_CHECK_EQUAL(expected, actual) \
+    do { \
+        if (!((expected) == (actual))) \
+            ::picmdk::test::reportFailure(std::string(#actual) + " is " + ::picmdk::toString(actual) + \
+                ", expected " + ::picmdk::toString(expected), __FILE__, __LINE__); \
+    } while (0)
+
+#define PICMDK_CHECK_CLOSE(expected, actual, tolerance) \
+    do { \
+        if (!(std::fabs((double)(expected) - (double)(actual)) <= (tolerance))) \
+            ::picmdk::test::reportFailure(std::string(#actual) + " is " + ::picmdk::toString(actual) + \
+                ", expected " + ::picmdk::toString(expected), __FILE__, __LINE__); \
+    } while (0)
+
+#define PICMDK_CHECK_THROW(statement, ExceptionType) \
+    do { \
+        bool isThrown = false; \
+        try { \
+            statement; \
+        } \
+        catch (ExceptionType&) { \
+            isThrown = true; \
+        } \
+        if (!isThrown) \
+            ::picmdk::test::reportFailure(std::string(#statement) + " does not throw " + #ExceptionType, __FILE__, __LINE__); \
+    } while (0)
+
+
+#endif